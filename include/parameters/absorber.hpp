@@ -3,27 +3,64 @@
 #include <time_dependent/observables.hpp>
 #include <utilities/types.hpp>
 #include <utilities/math.hpp>
+#include <complex>
 
 namespace Erwin
 {
 
+/*
+ * With every == 0 the mask scales the operator (from both sides) in every
+ * jacobian, so it acts continuously.  The operator is shared by every
+ * wavefunction, so one absorber (the first column's) does it for all of
+ * them; last() is what the mask takes out of this column's wavefunction,
+ * |U|^2 - |mask U|^2, at each sample.
+ *
+ * Otherwise the wavefunction itself is multiplied by the mask once every
+ * that many steps, and the operator is left alone (hermitian, for lanczos
+ * and chebyshev).  Then last() is the probability absorbed so far: this
+ * rank's part is summed in the same pass as the mask is applied, and added
+ * up over the ranks with the other observers' sums at the next sample.
+ */
 struct MaskAbsorber final : Observable {
-    MaskAbsorber( const petsc::Vector& mask_ )
-        : current_value( 0 ), mask( mask_ )
+    MaskAbsorber( const petsc::Vector& mask_, unsigned every_ = 0 )
+        : current_value( 0 ), mask( mask_ ), weight( mask_.duplicate() ),
+          every( every_ )
     {
+        // 1 - |mask|^2, for the sum above:
+        PetscInt n;
+        VecGetLocalSize( mask.v_, &n );
+        const PetscScalar* m;
+        PetscScalar* w;
+        VecGetArrayRead( mask.v_, &m );
+        VecGetArray( weight.v_, &w );
+        for ( PetscInt i = 0; i < n; ++i ) w[i] = 1. - std::norm( m[i] );
+        VecRestoreArray( weight.v_, &w );
+        VecRestoreArrayRead( mask.v_, &m );
     }
     void
-        operator()( const petsc::Matrix& , const petsc::Vector& , petsc::TimeStepper& ) {}
+        operator()( const petsc::Matrix& , const petsc::Vector& , Stepper& ) {}
 
     void
-        modify( petsc::Matrix& A, petsc::Vector& U, petsc::Vector& F, petsc::TimeStepper& ts );
+        modify( petsc::Matrix& A, petsc::Vector& U, petsc::Vector& F, Stepper& ts );
+    void after_step( petsc::Vector& U, Stepper& ts );
+    void request( Reductions& R, const petsc::Vector& U, Stepper& ts );
+    void reduced( const Reductions& R );
+    bool modifies_operator() const { return every == 0; }
 
     std::string last() const;
     std::string name() const;
 
+    void save( std::ostream& out ) { out << current_value << " "; }
+    void restore( std::istream& in ) { in >> current_value; }
+
   private:
     double current_value;
     const petsc::Vector mask;
+    petsc::Vector weight;
+    const unsigned every;
+    size_t handle{0};
+    // what this rank's masks took out since the last sample
+    double absorbed{0};
 };
 
 struct AbsorberParameters {
@@ -84,6 +121,9 @@ struct AbsorberParameters {
     // beginning of boundary)
     std::function<PetscScalar(double)> abs_function_n;
     std::function<PetscScalar(double)> abs_function_l;
+    // mask the wavefunction once every this many steps, instead of the
+    // operator (0, see MaskAbsorber)
+    unsigned every{0};
 
   private:
     type atype{type::custom};
@@ -75,6 +75,15 @@ struct BasisParameters {
     {
         return folder + "/l_" + to_string( l ) + "_r.dat";
     }
+    // where a raw l_* file lives once it is compressed:
+    string compressed_filename( const string& raw_filename ) const
+    {
+        return raw_filename.substr( 0, raw_filename.rfind( ".dat" ) ) + ".cdat";
+    }
+    string precision_report_filename() const
+    {
+        return folder + "/precision_report.txt";
+    }
     string prototype_filename() const { return folder + "/prototype.dat"; }
     void write_prototype( vector<BasisID> prototype ) const
     {
@@ -92,6 +101,12 @@ struct BasisParameters {
     unsigned nmax;
     unsigned lmax;
     double charge;
+    // the l_*.dat files are stored as floats (complex<float> for ecs)
+    bool single_precision{false};
+    // the l_* files are stored in compressed chunks, one per vector (see
+    // utilities/compressed_io.hpp), trimmed to where |v| > tolerance * max|v|
+    bool compressed{false};
+    double compress_tolerance{0};
     string folder;
     string atom;
     // the rest of these we ignore unless we are doing ecs stuff
@@ -2,54 +2,97 @@
 
 #include <boost/program_options.hpp>
 #include <time_dependent/observables.hpp>
+#include <time_dependent/dipole_operator.hpp>
+#include <utilities/async_writer.hpp>
 #include <unordered_map>
+#include <map>
+#include <utility>
 #include <utilities/types.hpp>
 
 namespace Erwin
 {
 
+/*
+ * <U_a|D|U_b> for every pair of sections a <= b of the basis, U_a being U
+ * on section a only.  A section is one label of a labelling of the basis
+ * (segments, see DipoleOperator::apply_segmented): "all" is the only label
+ * of the first, the n and energy sections the labels of the others.
+ *
+ * D U_b for every section comes from one apply_segmented (which reads D
+ * once per labelling, and always applies the whole D, even when an active
+ * window restricts the propagation), and the inner products from one pass
+ * over the rows of U, whatever the number of sections.
+ */
 struct DipoleObserver final : Observable {
-    DipoleObserver(
-        const std::string& folder_,
-        std::map<std::string, std::function<PetscScalar(PetscScalar, int)>>
-            sections_,
-        const petsc::Matrix& d )
-        : draw( 2, d.comm() ), sections( sections_ ), folder( folder_ ),
-          current_value( 0 ), Dipole( d )
+    DipoleObserver( const std::string& folder_,
+                    std::vector<std::vector<int>> segments_,
+                    std::map<std::string, std::pair<size_t, int>> sections_,
+                    const DipoleOperator& d,
+                    MPI_Comm comm = PETSC_COMM_WORLD )
+        : draw( 2, comm ), segments( segments_ ), sections( sections_ ),
+          folder( folder_ ), current_value( 0 ), Dipole( d )
     {
-        draw.set_title( "total dipole moment" );
-        // create an ofstream for the combination of each function:
-        for ( auto i = sections.cbegin(); i != sections.cend(); ++i ) {
-            for ( auto j = i; j != sections.cend(); ++j ) {
-                ofstreams[i->first].emplace(
-                    j->first,
-                    std::ofstream( folder + "/dipole_" + i->first + j->first +
-                                       ".dat",
-                                   std::ios_base::binary | std::ios_base::app |
-                                       std::ios_base::out ) );
-            }
+        for ( const auto& labels : segments ) {
+            first.push_back( products_size );
+            products_size += static_cast<size_t>(
+                DipoleOperator::segment_count( labels ) );
         }
+        draw.set_title( "total dipole moment" );
+        int rank;
+        MPI_Comm_rank( comm, &rank );
+        writer = rank == 0;
+        // a file of (t, <U_a|D|U_b>) records for every pair, in the order
+        // the pairs are reduced:
+        if ( writer )
+            for ( auto i = sections.cbegin(); i != sections.cend(); ++i )
+                for ( auto j = i; j != sections.cend(); ++j )
+                    files.push_back( AsyncWriter::shared().open(
+                        filename( i->first, j->first ), 3 * sizeof( double ),
+                        "t:f64,re:f64,im:f64" ) );
+    }
+    ~DipoleObserver()
+    {
+        for ( auto f : files ) AsyncWriter::shared().close( f );
     }
 
     void
-    operator()( const petsc::Matrix& A,const petsc::Vector& U, petsc::TimeStepper& ts );
+    operator()( const petsc::Matrix&,const petsc::Vector&, Stepper& ) {}
+    void request( Reductions& R, const petsc::Vector& U, Stepper& ts );
+    void reduced( const Reductions& R );
 
     void
-        modify( petsc::Matrix&, petsc::Vector&,petsc::Vector&, petsc::TimeStepper& ) {}
+        modify( petsc::Matrix&, petsc::Vector&,petsc::Vector&, Stepper& ) {}
 
     std::string last() const;
     std::string name() const;
 
+    void save( std::ostream& out );
+    void restore( std::istream& in );
+    void rewind();
+
   private:
+    std::string filename( const std::string& a, const std::string& b ) const
+    {
+        return folder + "/dipole_" + a + b + ".dat";
+    }
+
     petsc::Draw draw;
-    std::unordered_map<std::string,
-                       std::unordered_map<std::string, std::ofstream>>
-        ofstreams;
-    std::map<std::string, std::function<PetscScalar(PetscScalar, int)>>
-        sections;
+    // only the first rank writes, to files (pair by pair)
+    bool writer;
+    std::vector<size_t> files;
+    std::vector<std::vector<int>> segments;
+    // the labelling and the label of each
+    std::map<std::string, std::pair<size_t, int>> sections;
     const std::string folder;
     PetscScalar current_value;
-    const petsc::Matrix& Dipole;
+    const DipoleOperator& Dipole;
+    // D U_s for every label s, labelling by labelling from first
+    std::vector<size_t> first;
+    size_t products_size{0};
+    std::vector<petsc::Vector> products;
+    // the inner products asked for, pair by pair, and when
+    std::vector<size_t> handles;
+    double time{0};
 };
 
 struct DipoleParameters {
@@ -74,8 +117,9 @@ struct DipoleParameters {
     std::string print() const;
     void write() const;
     std::unique_ptr<Observable>
-    get_observer( const petsc::Matrix& Dipole,
-                  const std::vector<BasisID>& prototype ) const;
+    get_observer( const DipoleOperator& Dipole,
+                  const std::vector<BasisID>& prototype,
+                  MPI_Comm comm = PETSC_COMM_WORLD ) const;
 
   private:
     std::vector<unsigned> n_sections;
@@ -3,17 +3,31 @@
 #include <boost/program_options.hpp>
 #include <utilities/types.hpp>
 #include <time_dependent/observables.hpp>
+#include <time_dependent/hamiltonian_operator.hpp>
+#include <functional>
 
 namespace Erwin
 {
 
+/*
+ * The eigenstates of -i (H0 + E(t) D) near state, every n_steps steps.
+ *
+ * The observer has its own operator: slepc's shift-invert shifts and scales
+ * the matrix it is given, and a copy of a shell matrix still shares the
+ * shell's context, so on the propagator's operator that would change what
+ * is being propagated.  The spectral transformation is also kept as a
+ * shell (A - sigma I applied, never formed), so A itself is left alone.
+ */
 struct EigenstateObserver final : Observable {
-    EigenstateObserver( petsc::Matrix& A,
+    EigenstateObserver( const DipoleOperator& D,
+                        const petsc::Vector& H0,
+                        const std::function<double(double)>& ef,
                         unsigned dim,
                         const std::string& folder_,
                         unsigned n_steps,
                         BasisID state_ )
-        : es( A,
+        : op( D, H0 ), A( op.as_matrix() ), efield( ef ),
+          es( A,
               dim,
               petsc::EigenvalueSolver::Which::target_imag,
               petsc::EigenvalueSolver::Type::nonhermitian ),
@@ -23,6 +37,17 @@ struct EigenstateObserver final : Observable {
           state( state_ ), folder( folder_ )
     {
         assert( steps > 0 );
+        // A is a shell matrix (see HamiltonianOperator), so the shift-invert
+        // solves have to be iterative (it does provide its diagonal):
+        ST st;
+        KSP ksp;
+        PC pc;
+        EPSGetST( es.e_, &st );
+        STSetMatMode( st, STMATMODE_SHELL );
+        STGetKSP( st, &ksp );
+        KSPSetType( ksp, KSPGMRES );
+        KSPGetPC( ksp, &pc );
+        PCSetType( pc, PCJACOBI );
         draw_gs_pop.set_title( "instantaneous ground state population" );
         draw_gs.set_title( "instantaneous ground state population" );
         draw_gs.set_function( []( PetscScalar d, unsigned ) {
@@ -33,16 +58,20 @@ struct EigenstateObserver final : Observable {
         // TODO: add eigenstate.
     }
 
+    // (the propagator's operator is ignored, see above)
     void
-    operator()( const petsc::Matrix& A, const petsc::Vector& U, petsc::TimeStepper& ts );
+    operator()( const petsc::Matrix&, const petsc::Vector& U, Stepper& ts );
 
     void
-        modify( petsc::Matrix&, petsc::Vector&,petsc::Vector&, petsc::TimeStepper& ) {}
+        modify( petsc::Matrix&, petsc::Vector&,petsc::Vector&, Stepper& ) {}
 
     std::string last() const;
     std::string name() const;
 
   private:
+    HamiltonianOperator op;
+    petsc::Matrix A;
+    const std::function<double(double)> efield;
     petsc::EigenvalueSolver es;
     std::vector<petsc::Vector> space;
     std::ofstream gs_pop_file;
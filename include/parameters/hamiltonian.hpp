@@ -76,6 +76,16 @@ struct HamiltonianParameters {
     unsigned lmax;
     unsigned mmax;
     double emax;
+    // how much basis data (in MB) the dipole build may keep resident
+    size_t dipole_memory{2048};
+    // keep the dipole values in single precision during propagation
+    bool dipole_single_precision{false};
+    // build the dipole both ways (make_dipole_matrix, streamed) and compare
+    bool dipole_check{false};
+    // drop the states the laser can't populate above this (0 keeps them
+    // all, see truncate_prototype, and propagate_check for how much it
+    // changes the populations).
+    double truncate_tolerance{0};
     string folder;
     experimental::optional<BasisParameters> basis;
 };
@@ -84,6 +94,53 @@ struct HamiltonianParameters {
 vector<BasisID> shrink_prototype( vector<BasisID> rhs,
                                   BasisID largest_inclusive );
 
+// What truncate_prototype keeps of a prototype, and what it thinks of the
+// rest.
+struct Truncation {
+    vector<BasisID> prototype;
+    // where the kept states were in the original
+    vector<PetscInt> kept;
+    // the population estimate of every state of the original
+    vector<double> population;
+    // the states dropped because nothing couples them to the lowest one,
+    // and because their estimate is below the tolerance
+    size_t uncoupled{0};
+    size_t below{0};
+    // the sum of the estimates of the states dropped
+    double dropped{0};
+};
+
+// Keep the states a pulse of peak field F, frequency w and duration T can
+// put more than tolerance into, as estimated state by state from the
+// dipole couplings D (of the prototype) and the energies.  A transition
+// i -> j is given an amplitude
+//
+//   min(1, F |D_ij| / max(delta, 2 pi / T)),
+//
+// its first order amplitude, with delta the detuning of Re(E_j - E_i) from
+// one photon (absorbed or emitted) and 2 pi / T the width of the pulse's
+// spectrum.  A state's estimate is the square of the product along its
+// best path from the lowest state, which is always kept.  This is a
+// perturbative estimate: in strong fields the caps at 1 make it keep more,
+// not less.  Im E doesn't come into it: the damped (ecs) states carry the
+// outgoing flux, so they are judged like any other.  propagate_check
+// compares the populations a propagation gives in the whole and the
+// truncated basis.
+Truncation truncate_prototype( const vector<BasisID>& prototype,
+                               const petsc::Matrix& D,
+                               double field,
+                               double frequency,
+                               double duration,
+                               double tolerance );
+
+// D between the kept states of a Truncation only
+petsc::Matrix restrict_dipole( const petsc::Matrix& D,
+                               const vector<PetscInt>& kept );
+
+// the largest |E| in the prototype: |H0|, H0 being diagonal.  The field
+// adds up to F |D| to that, see DipoleOperator::max_row_sum.
+double spectral_radius( const vector<BasisID>& prototype );
+
 const HamiltonianParameters make_HamiltonianParameters( int argc,
                                                         const char** argv );
 }
@@ -2,17 +2,23 @@
 
 #include <boost/program_options.hpp>
 #include <utilities/math.hpp>
+#include <utilities/field_table.hpp>
+#include <utilities/async_writer.hpp>
 #include <time_dependent/observables.hpp>
 #include <functional>
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <experimental/optional>
 
 namespace Erwin
 {
 
 struct LaserEnvelope {
     virtual double operator()( double t, double frequency ) const = 0;
+    // the envelope is zero from here on
+    virtual double end( double frequency ) const = 0;
     virtual std::string print() const = 0;
     virtual boost::program_options::options_description options() = 0;
     virtual ~LaserEnvelope();
@@ -21,6 +27,7 @@ struct LaserEnvelope {
 
 struct sin_squared final : LaserEnvelope {
     double operator()( double t, double frequency ) const;
+    double end( double frequency ) const;
     std::string print() const;
     boost::program_options::options_description options();
 
@@ -30,29 +37,48 @@ struct sin_squared final : LaserEnvelope {
 
 struct EfieldObserver final : Observable {
     EfieldObserver( std::string folder_,
-                    const std::function<double(double)>& ef )
-        : draw( 1, PETSC_COMM_WORLD ), folder( folder_ ), current_value( 0 ),
-          efield( ef )
+                    const std::function<double(double)>& ef,
+                    MPI_Comm comm = PETSC_COMM_WORLD,
+                    const FieldTable* table_ = nullptr )
+        : draw( 1, comm ), folder( folder_ ), current_value( 0 ),
+          efield( ef ), table( table_ )
     {
         draw.set_title("Efield");
-        outfile.open( folder + "/efield.dat", std::ios_base::binary |
-                                                  std::ios_base::app |
-                                                  std::ios_base::out );
+        int rank;
+        MPI_Comm_rank( comm, &rank );
+        writer = rank == 0;
+        // records of (t, E(t)):
+        if ( writer )
+            file = AsyncWriter::shared().open( folder + "/efield.dat",
+                                               2 * sizeof( double ),
+                                               "t:f64,E:f64" );
+    }
+    ~EfieldObserver()
+    {
+        if ( writer ) AsyncWriter::shared().close( file );
     }
     void
-    operator()(const petsc::Matrix& A,const petsc::Vector& U, petsc::TimeStepper& ts );
+    operator()(const petsc::Matrix& A,const petsc::Vector& U, Stepper& ts );
 
-    void modify(petsc::Matrix&, petsc::Vector&,petsc::Vector&, petsc::TimeStepper&) {}
+    void modify(petsc::Matrix&, petsc::Vector&,petsc::Vector&, Stepper&) {}
 
     std::string last() const;
     std::string name() const;
 
+    void save( std::ostream& out );
+    void restore( std::istream& in );
+    void rewind();
+
   private:
     petsc::Draw draw;
     std::string folder;
-    std::ofstream outfile;
+    // only the first rank writes, to file
+    bool writer;
+    size_t file{0};
     double current_value;
     const std::function<double(double)>& efield;
+    // the zero crossings are looked up here instead of searched for
+    const FieldTable* table;
     double next_value{0};
     bool interpolate_next{false};
     unsigned zero{0};
@@ -63,13 +89,20 @@ struct LaserParameters {
     LaserParameters( double frequency_,
                      double cep_,
                      std::string folder_,
-                     std::shared_ptr<LaserEnvelope> envelope_ )
+                     std::shared_ptr<LaserEnvelope> envelope_,
+                     std::shared_ptr<const FieldTable> table_ = nullptr )
         : frequency( frequency_ ), cep( cep_ ), envelope( envelope_ ),
-          folder( folder_ ),
-          ef( [this]( double t ) {
-              return ( *this->envelope.get() )( t, this->frequency ) *
-                     sin( this->frequency * t + this->cep );
-          } )
+          table( table_ ), folder( folder_ ),
+          // by value, so that copies of the parameters (the scan makes
+          // some) don't evaluate a field that isn't there any more:
+          ef( table ? std::function<double(double)>( [table = table](
+                          double t ) { return ( *table )( t ); } )
+                    : std::function<double(double)>(
+                          [envelope = envelope_, frequency = frequency_,
+                           cep = cep_]( double t ) {
+                              return ( *envelope )( t, frequency ) *
+                                     sin( frequency * t + cep );
+                          } ) )
     {
     }
 
@@ -79,7 +112,16 @@ struct LaserParameters {
         return ef;
     }
 
-    std::unique_ptr<Observable> get_observer() const;
+    // the field is zero from here on
+    double field_end() const
+    {
+        return table ? table->end() : envelope->end( frequency );
+    }
+    // the largest |E(t)|, sampled over the pulse
+    double peak_field( unsigned samples = 10000 ) const;
+
+    std::unique_ptr<Observable>
+    get_observer( MPI_Comm comm = PETSC_COMM_WORLD ) const;
 
     std::string print() const;
     void write() const;
@@ -87,6 +129,11 @@ struct LaserParameters {
     double frequency;
     double cep;
     std::shared_ptr<LaserEnvelope> envelope;
+    // E(t) (and A(t)) on a fine grid, sampled from the envelope or read from
+    // filename: efield interpolates it (nullptr for the analytic field)
+    std::shared_ptr<const FieldTable> table;
+    std::experimental::optional<std::string> filename;
+    unsigned table_samples{0};
 
   private:
     std::string folder;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <petsc_cpp/Petsc.hpp>
 #include <experimental/optional>
 
@@ -9,6 +10,24 @@ namespace Erwin
 
 struct PropagationParameters {
 
+    // crank_nicolson: petsc's theta method, a linear solve every step.
+    // krylov: exp(-i H(t + dt/2) dt) from an arnoldi (or lanczos) space.
+    // interaction: krylov for the dipole coupling only, with the field free
+    // phases exact.
+    // magnus4, magnus6: commutator free magnus integrators of order 4 and 6,
+    // out of krylov exponentials (fixed steps only).  magnus6 has a
+    // backward substep, which amplifies damped (ecs, absorbed) components.
+    // chebyshev: like krylov, with a chebyshev expansion of the exponential
+    // (hermitian H only), for long steps.
+    enum class method {
+        crank_nicolson,
+        krylov,
+        interaction,
+        magnus4,
+        magnus6,
+        chebyshev
+    };
+
     PropagationParameters( double ti_,
                            double tf_,
                            double dt_,
@@ -28,7 +47,11 @@ struct PropagationParameters {
 
     std::string print() const;
     void write() const;
-    petsc::Vector read_initial_wavefunction() const;
+    petsc::Vector read_initial_wavefunction( MPI_Comm comm ) const;
+    // what to propagate, laid out like v: the initial wavefunction if there
+    // is one, the initial states otherwise
+    std::vector<petsc::Vector>
+    initial_wavefunctions( const petsc::Vector& v ) const;
     petsc::TimeStepper::times time() const;
 
 
@@ -37,8 +60,60 @@ struct PropagationParameters {
     double dt;
     std::string folder;
     std::experimental::optional<std::string> initial_wavefunction_filename;
+    method propagator{method::crank_nicolson};
+    // the largest krylov space, and the error allowed per exponential (all
+    // but crank_nicolson)
+    unsigned krylov_dimension{30};
+    double krylov_tolerance{1e-10};
+    // only orthogonalize against the last two vectors (hermitian H only)
+    bool krylov_lanczos{false};
+    // the basis states to start from, propagated together (krylov and
+    // interaction only), each with its observers in folder/state_<index>
+    // except the first, which uses folder.
+    std::vector<unsigned> initial_states{0};
+    // crank_nicolson: solve each step directly, by l-blocks (see
+    // BlockTridiagonal), instead of iteratively
+    bool direct{false};
+    // crank_nicolson: the number of eigenvectors the (deflated gmres) solver
+    // carries from one step to the next, and the number of previous
+    // solutions the initial guess is projected from (0 for neither; not
+    // with direct)
+    unsigned recycle{0};
+    unsigned guess{0};
+    // crank_nicolson: keep the operator (and its preconditioner or
+    // factorization) while the field changes by less than lag_tolerance
+    // (0 rebuilds it every time).  With lag_correct only the preconditioner
+    // is kept, and the solve corrects for the field it was built at.
+    double lag_tolerance{0};
+    bool lag_correct{false};
+    // fixed steps of the self stepping methods (all but crank_nicolson) are
+    // this many dt long, with the observers still sampled every dt
+    unsigned macro_steps{1};
+    // restrict the dipole operator to the states with an amplitude above
+    // active_threshold, plus active_margin more in n and l (0 for the whole
+    // basis, see ActiveSpace; not with direct, which factors the whole D)
+    double active_threshold{0};
+    unsigned active_margin{10};
+    // adaptive steps: the local error allowed per step, relative to the norm
+    // of the wavefunction (0 keeps every step at dt), estimated by step
+    // doubling, or by petsc's adaptor for crank_nicolson.  Steps over it are
+    // taken again.  dt is then just the spacing of the samples the
+    // observers see, and the first step.
+    double tolerance{0};
+    double dt_min{0};
+    // 0 is no limit
+    double dt_max{0};
+    // write a checkpoint (to folder) every this many samples (0 for none),
+    // and carry on from the last one, if there is one, with restart (which
+    // otherwise starts over, cutting the outputs back to their headers)
+    unsigned checkpoint_every{0};
+    bool restart{false};
 };
 
+std::istream& operator>>( std::istream& in, PropagationParameters::method& m );
+std::ostream& operator<<( std::ostream& out,
+                          const PropagationParameters::method& m );
+
 const PropagationParameters make_PropagationParameters( int argc,
                                                         const char** argv );
 }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Erwin
+{
+
+/*
+ * A parameter scan: one propagation per line of filename, each line a list
+ * of option=value overrides on top of the usual command line and config
+ * files, e.g.
+ *
+ *     laser_sin_squared_intensity=0.01 laser_cep=1.57
+ *
+ * Point i is written to folder/point_i (its propagate_folder).
+ */
+struct ScanParameters {
+
+    ScanParameters( std::string filename_,
+                    unsigned groups_,
+                    std::string folder_ )
+        : filename( filename_ ), groups( groups_ ), folder( folder_ )
+    {
+    }
+
+    std::string print() const;
+    void write() const;
+
+    // the overrides for each point
+    std::vector<std::vector<std::string>> read_points() const;
+    std::string point_folder( size_t i ) const
+    {
+        return folder + "/point_" + std::to_string( i );
+    }
+    // argv with the overrides of point i (and its folder) in place of
+    // whatever argv said about those options.
+    std::vector<std::string> point_arguments( int argc,
+                                              const char** argv,
+                                              size_t i ) const;
+
+    std::string filename;
+    // the number of MPI groups working through the points
+    unsigned groups;
+    std::string folder;
+};
+
+// argv with each of overrides ("name=value") in place of whatever argv said
+// about that option.
+std::vector<std::string>
+override_arguments( int argc,
+                    const char** argv,
+                    const std::vector<std::string>& overrides );
+
+const ScanParameters make_ScanParameters( int argc, const char** argv );
+}
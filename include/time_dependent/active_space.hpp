@@ -0,0 +1,100 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/dipole_operator.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace Erwin
+{
+
+/*
+ * The part of the basis that the wavefunction actually lives in.  Early in
+ * the pulse almost everything is in the lowest few states of the lowest
+ * few l, and the dipole products over the rest of the basis only ever
+ * multiply (next to) zero.
+ *
+ * The window is the first active[l] states of every l (the prototype is
+ * ordered by n within l): up to the last state with an amplitude above
+ * threshold, plus margin states for the population to spread into before
+ * the next update.  Every l next to an occupied one gets at least margin
+ * states, so the window can grow in l as well as in n; it shrinks again
+ * when the population leaves.
+ *
+ * Only the dipole operator is restricted (the expensive part); everything
+ * outside the window is still propagated by H0.  The error is of the order
+ * of threshold.
+ */
+struct ActiveSpace {
+    ActiveSpace( const DipoleOperator& D_,
+                 double threshold_,
+                 unsigned margin_,
+                 MPI_Comm comm_ = PETSC_COMM_WORLD )
+        : D( D_ ), offsets( D.l_offsets() ), threshold( threshold_ ),
+          margin( static_cast<PetscInt>( margin_ ) ), comm( comm_ )
+    {
+        if ( offsets.empty() )
+            throw std::invalid_argument( "ActiveSpace: the dipole operator "
+                                         "can't be restricted (use the block "
+                                         "dipole)" );
+    }
+
+    // restrict D to the window of psi (all of them)
+    void update( const std::vector<Vec>& psi )
+    {
+        const auto nl = offsets.size() - 1;
+        std::vector<long> last( nl, 0 ), all( nl );
+        for ( auto x : psi ) {
+            PetscInt start, end;
+            VecGetOwnershipRange( x, &start, &end );
+            const PetscScalar* xa;
+            VecGetArrayRead( x, &xa );
+            // the l of start, then walk forwards:
+            size_t a = static_cast<size_t>(
+                std::upper_bound( offsets.begin(), offsets.end(), start ) -
+                offsets.begin() - 1 );
+            for ( PetscInt i = start; i < end; ++i ) {
+                while ( i >= offsets[a + 1] ) a++;
+                if ( std::abs( xa[i - start] ) > threshold )
+                    last[a] = std::max( last[a],
+                                        static_cast<long>( i - offsets[a] ) +
+                                            1 );
+            }
+            VecRestoreArrayRead( x, &xa );
+        }
+        MPI_Allreduce( last.data(), all.data(), static_cast<int>( nl ),
+                       MPI_LONG, MPI_MAX, comm );
+
+        std::vector<PetscInt> active( nl, 0 );
+        for ( auto a = 0u; a < nl; ++a ) {
+            if ( all[a] == 0 ) continue;
+            grow( active, a, static_cast<PetscInt>( all[a] ) + margin );
+            if ( a > 0 ) grow( active, a - 1, margin );
+            if ( a + 1 < nl ) grow( active, a + 1, margin );
+        }
+        active_states = 0;
+        for ( auto n : active ) active_states += n;
+        D.set_window( active );
+    }
+
+    // the whole basis again
+    void reset() { D.set_window( {} ); }
+
+    // the size of the window after the last update
+    PetscInt active_states{0};
+
+  private:
+    void grow( std::vector<PetscInt>& active, size_t a, PetscInt n ) const
+    {
+        n = std::min( n, offsets[a + 1] - offsets[a] );
+        active[a] = std::max( active[a], n );
+    }
+
+    const DipoleOperator& D;
+    const std::vector<PetscInt> offsets;
+    const double threshold;
+    const PetscInt margin;
+    MPI_Comm comm;
+};
+}
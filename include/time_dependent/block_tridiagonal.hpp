@@ -0,0 +1,263 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <utilities/types.hpp>
+#include <utilities/math.hpp>
+#include <time_dependent/hamiltonian_operator.hpp>
+#include <time_dependent/dipole_operator.hpp>
+#include <vector>
+#include <complex>
+#include <stdexcept>
+
+namespace Erwin
+{
+
+/*
+ * A direct solver for the crank nicolson system
+ *
+ *     M = shift + scale L (H0 + E D) R
+ *
+ * (see HamiltonianOperator).  With the prototype ordered by l, D only
+ * couples l to l +/- 1, so M is block tridiagonal in l, with diagonal
+ * diagonal blocks, and the block thomas algorithm solves it exactly:
+ *
+ *     S_0 = M_00,  S_l = M_ll - M_l,l-1 W_l-1,  W_l = S_l^-1 M_l,l+1
+ *
+ * once per operator (factor), then a forward and a backward sweep per solve.
+ * Factoring is O(sum_l n_l^3) for n_l states of angular momentum l, so the
+ * cost of a step is fixed, and there is no convergence to wait for.
+ *
+ * Every rank holds all of D and does the whole (sequential) solve, and then
+ * keeps its own rows; it is meant for bases that fit on a rank.
+ *
+ * The values of D are taken as the operator that is propagated holds them
+ * (see DipoleOperator::stored), so that with a single precision dipole it
+ * solves the system that is actually being stepped.
+ */
+struct BlockTridiagonal {
+    BlockTridiagonal( const petsc::Matrix& D,
+                      const std::vector<BasisID>& prototype,
+                      const petsc::Vector& H0,
+                      const DipoleOperator& propagated )
+    {
+        using namespace std;
+        // the first state of each l:
+        vector<size_t> lblock( prototype.size() );
+        for ( auto i = 0u; i < prototype.size(); ++i ) {
+            if ( i == 0 || prototype[i].l != prototype[i - 1].l ) {
+                if ( i != 0 && prototype[i].l < prototype[i - 1].l )
+                    throw invalid_argument(
+                        "BlockTridiagonal: prototype isn't ordered by l" );
+                first.push_back( i );
+            }
+            lblock[i] = first.size() - 1;
+        }
+        first.push_back( prototype.size() );
+        const auto nl = first.size() - 1;
+
+        upper.resize( nl - 1 );
+        lower.resize( nl - 1 );
+        for ( auto a = 0u; a + 1 < nl; ++a ) {
+            upper[a].resize( size( a ) * size( a + 1 ), 0. );
+            lower[a].resize( size( a + 1 ) * size( a ), 0. );
+        }
+
+        // all of D, on every rank:
+        int ranks;
+        MPI_Comm_size( D.comm(), &ranks );
+        Mat all;
+        MatCreateRedundantMatrix( D.m_, ranks, PETSC_COMM_SELF,
+                                  MAT_INITIAL_MATRIX, &all );
+        for ( auto i = 0u; i < prototype.size(); ++i ) {
+            PetscInt ncols;
+            const PetscInt* cols;
+            const PetscScalar* vals;
+            MatGetRow( all, static_cast<PetscInt>( i ), &ncols, &cols, &vals );
+            auto a = lblock[i];
+            for ( PetscInt k = 0; k < ncols; ++k ) {
+                auto j = static_cast<size_t>( cols[k] );
+                auto b = lblock[j];
+                if ( b == a + 1 )
+                    upper[a][( i - first[a] ) * size( b ) + j - first[b]] =
+                        propagated.stored( vals[k] );
+                else if ( b + 1 == a )
+                    lower[b][( i - first[a] ) * size( b ) + j - first[b]] =
+                        propagated.stored( vals[k] );
+                else if ( vals[k] != 0. )
+                    throw invalid_argument( "BlockTridiagonal: D couples l "
+                                            "to more than l +/- 1" );
+            }
+            MatRestoreRow( all, static_cast<PetscInt>( i ), &ncols, &cols,
+                           &vals );
+        }
+        MatDestroy( &all );
+
+        VecScatterCreateToAll( H0.v_, &to_all, &all_local );
+        VecGetOwnershipRange( H0.v_, &rowstart, &rowend );
+        h = gather( H0.v_ );
+
+        LU.resize( nl );
+        pivots.resize( nl );
+        W.resize( nl - 1 );
+        sub.resize( nl - 1 );
+    }
+
+    BlockTridiagonal( const BlockTridiagonal& ) = delete;
+    BlockTridiagonal& operator=( const BlockTridiagonal& ) = delete;
+
+    ~BlockTridiagonal()
+    {
+        VecScatterDestroy( &to_all );
+        VecDestroy( &all_local );
+    }
+
+    // factor the operator as it is now.
+    void factor( const HamiltonianOperator& op )
+    {
+        using namespace std;
+        const auto nl = LU.size();
+        const auto shift = op.get_shift();
+        const auto coupling = op.get_scale() * op.field();
+        vector<complex> l( h.size(), 1. ), r( h.size(), 1. );
+        if ( op.get_left() ) l = gather( op.get_left() );
+        if ( op.get_right() ) r = gather( op.get_right() );
+
+        for ( auto a = 0u; a < nl; ++a ) {
+            const auto n = size( a );
+            auto& S = LU[a];
+            S.assign( n * n, 0. );
+            for ( auto i = 0u; i < n; ++i ) {
+                auto g = first[a] + i;
+                S[i * n + i] = shift + op.get_scale() * l[g] * h[g] * r[g];
+            }
+            if ( a > 0 ) {
+                // S -= M_a,a-1 W_a-1
+                const auto m = size( a - 1 );
+                auto& M = sub[a - 1];
+                M = lower[a - 1];
+                for ( auto i = 0u; i < n; ++i )
+                    for ( auto k = 0u; k < m; ++k )
+                        M[i * m + k] *= coupling * l[first[a] + i] *
+                                        r[first[a - 1] + k];
+                const auto& Wp = W[a - 1];
+                for ( auto i = 0u; i < n; ++i )
+                    for ( auto k = 0u; k < m; ++k ) {
+                        auto f = M[i * m + k];
+                        if ( f == 0. ) continue;
+                        for ( auto j = 0u; j < n; ++j )
+                            S[i * n + j] -= f * Wp[k * n + j];
+                    }
+            }
+            pivots[a] = math::lu_factor( S, n );
+            if ( a + 1 < nl ) {
+                const auto m = size( a + 1 );
+                auto& Wa = W[a];
+                Wa = upper[a];
+                for ( auto i = 0u; i < n; ++i )
+                    for ( auto k = 0u; k < m; ++k )
+                        Wa[i * m + k] *= coupling * l[first[a] + i] *
+                                         r[first[a + 1] + k];
+                math::lu_solve( S, pivots[a], n, Wa.data(), m );
+            }
+        }
+    }
+
+    // x = M^-1 b
+    void solve( Vec b, Vec x ) const
+    {
+        const auto nl = LU.size();
+        auto g = gather( b );
+        for ( auto a = 0u; a < nl; ++a ) {
+            const auto n = size( a );
+            if ( a > 0 ) {
+                const auto m = size( a - 1 );
+                const auto& M = sub[a - 1];
+                for ( auto i = 0u; i < n; ++i )
+                    for ( auto k = 0u; k < m; ++k )
+                        g[first[a] + i] -= M[i * m + k] * g[first[a - 1] + k];
+            }
+            math::lu_solve( LU[a], pivots[a], n, &g[first[a]], 1 );
+        }
+        for ( auto a = nl - 1; a-- > 0; ) {
+            const auto n = size( a ), m = size( a + 1 );
+            const auto& Wa = W[a];
+            for ( auto i = 0u; i < n; ++i )
+                for ( auto k = 0u; k < m; ++k )
+                    g[first[a] + i] -= Wa[i * m + k] * g[first[a + 1] + k];
+        }
+
+        PetscScalar* xa;
+        VecGetArray( x, &xa );
+        std::copy( g.begin() + rowstart, g.begin() + rowend, xa );
+        VecRestoreArray( x, &xa );
+    }
+
+    // make ksp a single direct solve with this, refactored whenever the
+    // operator changes.
+    void precondition( KSP ksp, const HamiltonianOperator& op )
+    {
+        operator_ = &op;
+        KSPSetType( ksp, KSPPREONLY );
+        PC pc;
+        KSPGetPC( ksp, &pc );
+        PCSetType( pc, PCSHELL );
+        PCShellSetContext( pc, this );
+        PCShellSetSetUp( pc, &pc_setup );
+        PCShellSetApply( pc, &pc_apply );
+        PCShellSetName( pc, "block tridiagonal (in l) direct solve" );
+    }
+
+  private:
+    typedef std::complex<double> complex;
+
+    size_t size( size_t a ) const { return first[a + 1] - first[a]; }
+
+    // all of v, on every rank
+    std::vector<complex> gather( Vec v ) const
+    {
+        VecScatterBegin( to_all, v, all_local, INSERT_VALUES,
+                         SCATTER_FORWARD );
+        VecScatterEnd( to_all, v, all_local, INSERT_VALUES, SCATTER_FORWARD );
+        PetscInt n;
+        VecGetLocalSize( all_local, &n );
+        const PetscScalar* a;
+        VecGetArrayRead( all_local, &a );
+        std::vector<complex> g( a, a + n );
+        VecRestoreArrayRead( all_local, &a );
+        return g;
+    }
+
+    static PetscErrorCode pc_setup( PC pc )
+    {
+        BlockTridiagonal* self;
+        PCShellGetContext( pc, &self );
+        self->factor( *self->operator_ );
+        return 0;
+    }
+    static PetscErrorCode pc_apply( PC pc, Vec b, Vec x )
+    {
+        BlockTridiagonal* self;
+        PCShellGetContext( pc, &self );
+        self->solve( b, x );
+        return 0;
+    }
+
+    // the first state of each l (and the total)
+    std::vector<size_t> first;
+    // D_l,l+1 and D_l+1,l, row major
+    std::vector<std::vector<complex>> upper;
+    std::vector<std::vector<complex>> lower;
+    std::vector<complex> h;
+    PetscInt rowstart;
+    PetscInt rowend;
+    VecScatter to_all;
+    Vec all_local;
+
+    // the factorization: LU of S_l, W_l, and the scaled M_l+1,l
+    std::vector<std::vector<complex>> LU;
+    std::vector<std::vector<size_t>> pivots;
+    std::vector<std::vector<complex>> W;
+    std::vector<std::vector<complex>> sub;
+    const HamiltonianOperator* operator_{nullptr};
+};
+}
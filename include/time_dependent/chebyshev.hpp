@@ -0,0 +1,139 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/dipole_operator.hpp>
+#include <time_dependent/hamiltonian_operator.hpp>
+#include <utilities/math.hpp>
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+namespace Erwin
+{
+
+/*
+ * psi <- exp(-i H dt) psi for H = H0 + E D, by its chebyshev expansion.
+ * With the spectrum of H inside [c - r, c + r] and X = (H - c) / r,
+ *
+ *     exp(-i H dt) = exp(-i c dt) sum_k (2 - delta_k0) (-i)^k J_k(r dt) T_k(X)
+ *
+ * and T_k(X) psi comes from the three term recurrence, one product with H
+ * per term.  J_k(r dt) drops off faster than exponentially once k > r dt,
+ * so a step of any length is accurate to the tolerance, and costs about
+ * r dt products: there are no inner products at all, unlike krylov.
+ *
+ * The bounds are the smallest and largest energy in H0, widened by
+ * |E| |D|, with |D| bounded by its largest absolute row sum: any part of
+ * the spectrum outside the bounds would grow like T_k outside [-1, 1],
+ * exponentially, so they have to be guaranteed, not estimated.
+ * H has to be hermitian, so no ecs.  An absorber's scaling of the operator
+ * is taken as it comes: the mask only damps, which keeps the expansion
+ * stable, but it isn't part of the bounds.
+ */
+struct ChebyshevExponential {
+    ChebyshevExponential( const petsc::Vector& H0,
+                          const DipoleOperator& D,
+                          double tolerance_ )
+        : tolerance( tolerance_ )
+    {
+        PetscInt n;
+        VecGetLocalSize( H0.v_, &n );
+        const PetscScalar* h;
+        VecGetArrayRead( H0.v_, &h );
+        double bounds[3] = {std::numeric_limits<double>::infinity(),
+                            std::numeric_limits<double>::infinity(), 0};
+        for ( PetscInt i = 0; i < n; ++i ) {
+            bounds[0] = std::min( bounds[0], h[i].real() );
+            bounds[1] = std::min( bounds[1], -h[i].real() );
+            bounds[2] = std::max( bounds[2], std::abs( h[i].imag() ) );
+        }
+        VecRestoreArrayRead( H0.v_, &h );
+        double all[3];
+        MPI_Allreduce( bounds, all, 2, MPI_DOUBLE, MPI_MIN, H0.comm() );
+        MPI_Allreduce( bounds + 2, all + 2, 1, MPI_DOUBLE, MPI_MAX,
+                       H0.comm() );
+        if ( all[2] > 0 )
+            throw std::invalid_argument(
+                "ChebyshevExponential: H0 isn't hermitian (ecs?)" );
+        emin = all[0];
+        emax = -all[1];
+        dnorm = D.max_row_sum();
+    }
+
+    ChebyshevExponential( const ChebyshevExponential& ) = delete;
+    ChebyshevExponential& operator=( const ChebyshevExponential& ) = delete;
+
+    ~ChebyshevExponential()
+    {
+        for ( auto& w : work ) VecDestroy( &w );
+    }
+
+    // psi <- exp(dt A) psi, for A = -i (H0 + E D) (a HamiltonianOperator
+    // after set_field)
+    void apply( const HamiltonianOperator& A, Vec psi, double dt )
+    {
+        apply( A, std::vector<Vec>{psi}, dt );
+    }
+
+    void apply( const HamiltonianOperator& A,
+                const std::vector<Vec>& psi,
+                double dt )
+    {
+        using namespace std;
+        typedef complex<double> complex;
+        const auto K = psi.size();
+        while ( work.size() < 3 * K ) {
+            work.emplace_back();
+            VecDuplicate( psi.front(), &work.back() );
+        }
+
+        const auto spread = std::abs( A.field() ) * dnorm;
+        const auto c = ( emax + emin ) / 2;
+        const auto r = std::max( ( emax - emin ) / 2 + spread, 1e-14 );
+        auto J = math::chebyshev_exp_coefficients( r * dt, tolerance );
+
+        // T_{k-1}, T_k and T_{k+1} of each column, psi is the sum:
+        vector<Vec> previous( K ), current( K ), next( K );
+        for ( auto k = 0u; k < K; ++k ) {
+            previous[k] = work[3 * k];
+            current[k] = work[3 * k + 1];
+            next[k] = work[3 * k + 2];
+            VecCopy( psi[k], previous[k] );
+            VecScale( psi[k], J[0] );
+        }
+        // X x = (i A x - c x) / r
+        auto X = [&]( const vector<Vec>& x, const vector<Vec>& y ) {
+            A.apply_block( x, y );
+            for ( auto k = 0u; k < K; ++k )
+                VecAXPBY( y[k], -c / r, complex( 0, 1 / r ), x[k] );
+        };
+        complex phase( 0, -1 );
+        if ( J.size() > 1 ) {
+            X( previous, current );
+            for ( auto k = 0u; k < K; ++k )
+                VecAXPY( psi[k], 2. * phase * J[1], current[k] );
+        }
+        for ( auto j = 2u; j < J.size(); ++j ) {
+            phase *= complex( 0, -1 );
+            X( current, next );
+            for ( auto k = 0u; k < K; ++k ) {
+                VecAXPBY( next[k], -1., 2., previous[k] );
+                VecAXPY( psi[k], 2. * phase * J[j], next[k] );
+            }
+            swap( previous, current );
+            swap( current, next );
+        }
+        for ( auto k = 0u; k < K; ++k )
+            VecScale( psi[k], exp( complex( 0, -c * dt ) ) );
+    }
+
+  private:
+    const double tolerance;
+    double emin;
+    double emax;
+    double dnorm;
+    std::vector<Vec> work;
+};
+}
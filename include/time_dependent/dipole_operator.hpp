@@ -0,0 +1,582 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <utilities/types.hpp>
+#include <vector>
+#include <stdexcept>
+#include <memory>
+#include <type_traits>
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+namespace Erwin
+{
+
+// Anything that can apply the dipole operator to a wavefunction.
+struct DipoleOperator {
+    // y = D x
+    void mult( const petsc::Vector& x, petsc::Vector& y ) const
+    {
+        apply( x.v_, y.v_ );
+    }
+    virtual void apply( Vec x, Vec y ) const = 0;
+    // y[k] = D x[k] for a block of vectors
+    virtual void apply_block( const std::vector<Vec>& x,
+                              const std::vector<Vec>& y ) const
+    {
+        for ( auto k = 0u; k < x.size(); ++k ) apply( x[k], y[k] );
+    }
+    // D x split by columns: for each labelling of the columns in segments
+    // (one label per global index, -1 for none), and each label s in it,
+    // y gets D x_s, with x_s the part of x labelled s.  Those are in order,
+    // labelling by labelling and label by label (see segment_count).  This
+    // masks x and applies D to all of them as a block; the block operator
+    // reads D once per labelling instead.  It is meant for observables, so
+    // it is always the whole of D, whatever set_window says.
+    virtual void apply_segmented( Vec x,
+                                  const std::vector<std::vector<int>>& segments,
+                                  const std::vector<Vec>& y ) const
+    {
+        PetscInt start, end;
+        VecGetOwnershipRange( x, &start, &end );
+        const PetscScalar* xa;
+        VecGetArrayRead( x, &xa );
+        std::vector<Vec> masked;
+        for ( const auto& labels : segments )
+            for ( int s = 0; s < segment_count( labels ); ++s ) {
+                masked.emplace_back();
+                VecDuplicate( x, &masked.back() );
+                PetscScalar* m;
+                VecGetArray( masked.back(), &m );
+                for ( PetscInt i = start; i < end; ++i )
+                    m[i - start] =
+                        labels[static_cast<size_t>( i )] == s ? xa[i - start]
+                                                              : 0.;
+                VecRestoreArray( masked.back(), &m );
+            }
+        VecRestoreArrayRead( x, &xa );
+        apply_block( masked, y );
+        for ( auto& m : masked ) VecDestroy( &m );
+    }
+    // the number of labels used in a labelling
+    static int segment_count( const std::vector<int>& labels )
+    {
+        return labels.empty()
+                   ? 0
+                   : *std::max_element( labels.begin(), labels.end() ) + 1;
+    }
+
+    // the value this operator holds for an element v of the dipole matrix
+    // (v itself, unless it is stored in less precision)
+    virtual PetscScalar stored( PetscScalar v ) const { return v; }
+
+    // the largest sum of |D_ij| over a row, on every rank: for hermitian D
+    // an upper bound of |D|, the largest |eigenvalue|.
+    virtual double max_row_sum() const = 0;
+
+    // the number of rows on this rank, and overall
+    virtual PetscInt local_size() const = 0;
+    virtual PetscInt size() const = 0;
+
+    // the first state of each l (and then the size), for operators that can
+    // be restricted to a window of the basis, empty otherwise.
+    virtual std::vector<PetscInt> l_offsets() const { return {}; }
+    // only apply D between the first active[l] states of every l (the rest
+    // of y is zero); an empty window is the whole basis.  See ActiveSpace.
+    virtual void set_window( const std::vector<PetscInt>& ) const {}
+
+    // a shell matrix that applies this operator, for anything that wants a
+    // petsc::Matrix (inner products, eigenvalue solvers...).  It refers to
+    // this object, so it can't outlive it.
+    petsc::Matrix as_matrix( MPI_Comm comm = PETSC_COMM_WORLD ) const
+    {
+        Mat m;
+        MatCreateShell( comm, local_size(), local_size(), size(), size(),
+                        const_cast<DipoleOperator*>( this ), &m );
+        MatShellSetOperation( m, MATOP_MULT,
+                              reinterpret_cast<void ( * )( void )>(
+                                  &DipoleOperator::shell_mult ) );
+        return petsc::Matrix( m );
+    }
+
+    virtual ~DipoleOperator();
+
+  private:
+    static PetscErrorCode shell_mult( Mat m, Vec x, Vec y )
+    {
+        DipoleOperator* self;
+        MatShellGetContext( m, &self );
+        self->apply( x, y );
+        return 0;
+    }
+};
+
+// to kill the weak vtable error... need to figure out why that happens
+inline DipoleOperator::~DipoleOperator() {}
+
+// The dipole matrix as it is stored on disk, a general sparse (aij) matrix.
+struct MatrixDipole final : DipoleOperator {
+    MatrixDipole( const petsc::Matrix& D_ ) : D( D_ ) {}
+
+    void apply( Vec x, Vec y ) const { MatMult( D.m_, x, y ); }
+    double max_row_sum() const
+    {
+        PetscReal norm;
+        MatNorm( D.m_, NORM_INFINITY, &norm );
+        return norm;
+    }
+    PetscInt local_size() const
+    {
+        PetscInt n;
+        MatGetLocalSize( D.m_, &n, PETSC_NULL );
+        return n;
+    }
+    PetscInt size() const
+    {
+        PetscInt n;
+        MatGetSize( D.m_, &n, PETSC_NULL );
+        return n;
+    }
+
+  private:
+    const petsc::Matrix& D;
+};
+
+// The dipole matrix only couples l to l+/-1, and each of those couplings is
+// a dense (nmax - l) x (nmax - l -/+ 1) block.  So we store the blocks
+// densely with their offsets, and apply them as a series of dense
+// matrix-vector products, without any per element column indices.
+//
+// Each rank holds the rows of the blocks it owns.  The prototype must be
+// ordered by l (the basis and shrink_prototype both do this), so that every
+// l is a contiguous range of rows.
+//
+// Value is the stored type: without ecs the dipole matrix is real, and
+// BlockDipole<PetscReal> streams half the bytes per application.  float and
+// complex<float> halve it again, for runs that can live with single
+// precision values (sums are still done in double).
+template <typename Value = PetscScalar>
+struct BlockDipole final : DipoleOperator {
+    struct Block {
+        PetscInt row;
+        PetscInt col;
+        PetscInt rows;
+        PetscInt cols;
+        // row major
+        std::vector<Value> values;
+    };
+
+    BlockDipole( const petsc::Matrix& D, const std::vector<BasisID>& prototype )
+    {
+        using namespace std;
+        // the row range of each l:
+        vector<array<PetscInt, 2>> lranges;
+        vector<size_t> lblock( prototype.size() );
+        for ( auto i = 0u; i < prototype.size(); ++i ) {
+            if ( i == 0 || prototype[i].l != prototype[i - 1].l ) {
+                if ( i != 0 && prototype[i].l < prototype[i - 1].l )
+                    throw invalid_argument(
+                        "BlockDipole: prototype isn't ordered by l" );
+                lranges.push_back( {{static_cast<PetscInt>( i ),
+                                     static_cast<PetscInt>( i )}} );
+            }
+            lranges.back()[1] = static_cast<PetscInt>( i ) + 1;
+            lblock[i] = lranges.size() - 1;
+        }
+        for ( auto& r : lranges ) offsets.push_back( r[0] );
+        offsets.push_back( static_cast<PetscInt>( prototype.size() ) );
+
+        comm = D.comm();
+        MatGetSize( D.m_, &size_, PETSC_NULL );
+        MatGetOwnershipRange( D.m_, &rowstart, &rowend );
+        colstart = rowend;
+        colend = rowstart;
+
+        // one block per (row l, column l) pair, clipped to the rows we own:
+        vector<vector<long>> index( lranges.size(),
+                                    vector<long>( lranges.size(), -1 ) );
+        for ( PetscInt i = rowstart; i < rowend; ++i ) {
+            PetscInt ncols;
+            const PetscInt* cols;
+            const PetscScalar* vals;
+            MatGetRow( D.m_, i, &ncols, &cols, &vals );
+            auto a = lblock[static_cast<size_t>( i )];
+            for ( PetscInt k = 0; k < ncols; ++k ) {
+                auto b = lblock[static_cast<size_t>( cols[k] )];
+                // the diagonal is stored explicitly, but it is always zero:
+                if ( a == b ) {
+                    assert( vals[k] == 0. );
+                    continue;
+                }
+                if ( index[a][b] < 0 ) {
+                    index[a][b] = static_cast<long>( blocks.size() );
+                    auto first = max( rowstart, lranges[a][0] );
+                    auto last = min( rowend, lranges[a][1] );
+                    Block blk{first, lranges[b][0], last - first,
+                              lranges[b][1] - lranges[b][0],
+                              vector<Value>()};
+                    blk.values.resize(
+                        static_cast<size_t>( blk.rows * blk.cols ), 0. );
+                    colstart = min( colstart, blk.col );
+                    colend = max( colend, blk.col + blk.cols );
+                    blocks.push_back( move( blk ) );
+                    block_l.push_back( {{a, b}} );
+                }
+                auto& blk = blocks[static_cast<size_t>( index[a][b] )];
+                blk.values[static_cast<size_t>( ( i - blk.row ) * blk.cols +
+                                                cols[k] - blk.col )] =
+                    value( vals[k], is_floating_point<Value>() );
+            }
+            MatRestoreRow( D.m_, i, &ncols, &cols, &vals );
+        }
+        if ( colend < colstart ) colstart = colend = rowstart;
+
+        // we only ever need the columns our blocks touch, which is a
+        // contiguous range (l-1 through l+1 of the rows we own):
+        VecCreateSeq( PETSC_COMM_SELF, colend - colstart, &xlocal );
+        IS is;
+        ISCreateStride( PETSC_COMM_SELF, colend - colstart, colstart, 1, &is );
+        Vec x;
+        MatCreateVecs( D.m_, &x, PETSC_NULL );
+        VecScatterCreate( x, is, xlocal, PETSC_NULL, &scatter );
+        VecDestroy( &x );
+        ISDestroy( &is );
+    }
+
+    BlockDipole( const BlockDipole& ) = delete;
+    BlockDipole& operator=( const BlockDipole& ) = delete;
+
+    ~BlockDipole()
+    {
+        VecScatterDestroy( &scatter );
+        VecDestroy( &xlocal );
+        for ( auto& v : xlocals ) VecDestroy( &v );
+    }
+
+    void apply( Vec x, Vec y ) const
+    {
+        VecScatterBegin( scatter, x, xlocal, INSERT_VALUES, SCATTER_FORWARD );
+        VecScatterEnd( scatter, x, xlocal, INSERT_VALUES, SCATTER_FORWARD );
+
+        const PetscScalar* xa;
+        PetscScalar* ya;
+        VecGetArrayRead( xlocal, &xa );
+        VecGetArray( y, &ya );
+        std::fill( ya, ya + ( rowend - rowstart ), PetscScalar( 0 ) );
+        for ( auto i = 0u; i < blocks.size(); ++i ) {
+            const auto& blk = blocks[i];
+            PetscInt rows, cols;
+            window( i, rows, cols );
+            const PetscScalar* xb = xa + ( blk.col - colstart );
+            PetscScalar* yb = ya + ( blk.row - rowstart );
+            const Value* v = blk.values.data();
+            for ( PetscInt r = 0; r < rows; ++r, v += blk.cols )
+                yb[r] += dot( v, xb, cols );
+        }
+        VecRestoreArray( y, &ya );
+        VecRestoreArrayRead( xlocal, &xa );
+    }
+
+    // every value of D is read once for the whole block, rather than once per
+    // vector: the columns of x are interleaved (xi[c * K + k] = x[k][c]) so
+    // each row of a block is one pass over its values and K accumulators.
+    void apply_block( const std::vector<Vec>& x,
+                      const std::vector<Vec>& y ) const
+    {
+        const auto K = static_cast<PetscInt>( x.size() );
+        if ( K == 1 ) return apply( x[0], y[0] );
+        const auto ncols = colend - colstart;
+        while ( static_cast<PetscInt>( xlocals.size() ) < K ) {
+            Vec v;
+            VecDuplicate( xlocal, &v );
+            xlocals.push_back( v );
+        }
+        for ( PetscInt k = 0; k < K; ++k )
+            VecScatterBegin( scatter, x[k], xlocals[k], INSERT_VALUES,
+                             SCATTER_FORWARD );
+        for ( PetscInt k = 0; k < K; ++k )
+            VecScatterEnd( scatter, x[k], xlocals[k], INSERT_VALUES,
+                           SCATTER_FORWARD );
+
+        xi.resize( static_cast<size_t>( ncols * K ) );
+        for ( PetscInt k = 0; k < K; ++k ) {
+            const PetscScalar* xa;
+            VecGetArrayRead( xlocals[k], &xa );
+            for ( PetscInt c = 0; c < ncols; ++c ) xi[c * K + k] = xa[c];
+            VecRestoreArrayRead( xlocals[k], &xa );
+        }
+
+        std::vector<PetscScalar*> ya( K );
+        for ( PetscInt k = 0; k < K; ++k ) {
+            VecGetArray( y[k], &ya[k] );
+            std::fill( ya[k], ya[k] + ( rowend - rowstart ), PetscScalar( 0 ) );
+        }
+        std::vector<PetscScalar> acc( K );
+        for ( auto i = 0u; i < blocks.size(); ++i ) {
+            const auto& blk = blocks[i];
+            PetscInt rows, cols;
+            window( i, rows, cols );
+            const PetscScalar* xb = xi.data() + ( blk.col - colstart ) * K;
+            const Value* v = blk.values.data();
+            for ( PetscInt r = 0; r < rows; ++r, v += blk.cols ) {
+                std::fill( acc.begin(), acc.end(), PetscScalar( 0 ) );
+                for ( PetscInt c = 0; c < cols; ++c ) {
+                    const auto vc = widen( v[c] );
+                    const PetscScalar* xc = xb + c * K;
+                    for ( PetscInt k = 0; k < K; ++k ) acc[k] += vc * xc[k];
+                }
+                for ( PetscInt k = 0; k < K; ++k )
+                    ya[k][blk.row - rowstart + r] += acc[k];
+            }
+        }
+        for ( PetscInt k = 0; k < K; ++k ) VecRestoreArray( y[k], &ya[k] );
+    }
+
+    // each row of each block is split into the runs of columns with the
+    // same label, so D is read once per labelling, whatever the number of
+    // labels in it.  The window is ignored: observers want the real D.
+    void apply_segmented( Vec x,
+                          const std::vector<std::vector<int>>& segments,
+                          const std::vector<Vec>& y ) const
+    {
+        VecScatterBegin( scatter, x, xlocal, INSERT_VALUES, SCATTER_FORWARD );
+        VecScatterEnd( scatter, x, xlocal, INSERT_VALUES, SCATTER_FORWARD );
+
+        std::vector<PetscScalar*> ya( y.size() );
+        for ( auto k = 0u; k < y.size(); ++k ) {
+            VecGetArray( y[k], &ya[k] );
+            std::fill( ya[k], ya[k] + ( rowend - rowstart ), PetscScalar( 0 ) );
+        }
+        const PetscScalar* xa;
+        VecGetArrayRead( xlocal, &xa );
+        // first column, length, and which y
+        struct run {
+            PetscInt col;
+            PetscInt n;
+            size_t k;
+        };
+        std::vector<run> runs;
+        for ( auto i = 0u; i < blocks.size(); ++i ) {
+            const auto& blk = blocks[i];
+            runs.clear();
+            size_t first = 0;
+            for ( const auto& labels : segments ) {
+                for ( PetscInt c = 0; c < blk.cols; ++c ) {
+                    const auto s = labels[static_cast<size_t>( blk.col + c )];
+                    if ( s < 0 ) continue;
+                    const auto k = first + static_cast<size_t>( s );
+                    if ( !runs.empty() && runs.back().k == k &&
+                         runs.back().col + runs.back().n == c )
+                        runs.back().n++;
+                    else
+                        runs.push_back( {c, 1, k} );
+                }
+                first += static_cast<size_t>( segment_count( labels ) );
+            }
+            const PetscScalar* xb = xa + ( blk.col - colstart );
+            const Value* v = blk.values.data();
+            for ( PetscInt r = 0; r < blk.rows; ++r, v += blk.cols )
+                for ( const auto& u : runs )
+                    ya[u.k][blk.row - rowstart + r] +=
+                        dot( v + u.col, xb + u.col, u.n );
+        }
+        VecRestoreArrayRead( xlocal, &xa );
+        for ( auto k = 0u; k < y.size(); ++k ) VecRestoreArray( y[k], &ya[k] );
+    }
+
+    // over the whole of D, whatever the window
+    double max_row_sum() const
+    {
+        std::vector<double> sums( static_cast<size_t>( rowend - rowstart ),
+                                  0. );
+        for ( const auto& blk : blocks ) {
+            const Value* v = blk.values.data();
+            for ( PetscInt r = 0; r < blk.rows; ++r )
+                for ( PetscInt c = 0; c < blk.cols; ++c, ++v )
+                    sums[static_cast<size_t>( blk.row - rowstart + r )] +=
+                        std::abs( widen( *v ) );
+        }
+        double local = 0, all;
+        for ( auto s : sums ) local = std::max( local, s );
+        MPI_Allreduce( &local, &all, 1, MPI_DOUBLE, MPI_MAX, comm );
+        return all;
+    }
+
+    PetscScalar stored( PetscScalar v ) const
+    {
+        return widen( value( v, std::is_floating_point<Value>() ) );
+    }
+
+    PetscInt local_size() const { return rowend - rowstart; }
+    PetscInt size() const { return size_; }
+
+    std::vector<PetscInt> l_offsets() const { return offsets; }
+    void set_window( const std::vector<PetscInt>& active_ ) const
+    {
+        active = active_;
+    }
+
+    // the number of bytes of matrix values held on this rank
+    size_t bytes() const
+    {
+        size_t b = 0;
+        for ( const auto& blk : blocks )
+            b += blk.values.size() * sizeof( Value );
+        return b;
+    }
+
+  private:
+    // the rows and columns of block i inside the window
+    void window( size_t i, PetscInt& rows, PetscInt& cols ) const
+    {
+        const auto& blk = blocks[i];
+        rows = blk.rows;
+        cols = blk.cols;
+        if ( active.empty() ) return;
+        auto clip = []( PetscInt end, PetscInt first, PetscInt n ) {
+            return std::max( PetscInt( 0 ), std::min( n, end - first ) );
+        };
+        const auto a = block_l[i][0], b = block_l[i][1];
+        rows = clip( offsets[a] + active[a], blk.row, blk.rows );
+        cols = clip( offsets[b] + active[b], blk.col, blk.cols );
+    }
+
+    // v . x for one row of a block.
+    static PetscScalar
+    dot( const PetscScalar* v, const PetscScalar* x, PetscInt n )
+    {
+        PetscScalar sum = 0;
+        for ( PetscInt c = 0; c < n; ++c ) sum += v[c] * x[c];
+        return sum;
+    }
+    // real values against a complex vector: run the real and imaginary parts
+    // as two real dot products over the interleaved vector, rather than
+    // promoting v to complex.
+    static PetscScalar
+    dot( const PetscReal* v, const PetscScalar* x_, PetscInt n )
+    {
+        const PetscReal* x = reinterpret_cast<const PetscReal*>( x_ );
+        PetscReal re = 0, im = 0;
+        for ( PetscInt c = 0; c < n; ++c ) {
+            re += v[c] * x[2 * c];
+            im += v[c] * x[2 * c + 1];
+        }
+        return PetscScalar( re, im );
+    }
+    // single precision storage still accumulates in double:
+    static PetscScalar dot( const float* v, const PetscScalar* x_, PetscInt n )
+    {
+        const PetscReal* x = reinterpret_cast<const PetscReal*>( x_ );
+        PetscReal re = 0, im = 0;
+        for ( PetscInt c = 0; c < n; ++c ) {
+            re += static_cast<PetscReal>( v[c] ) * x[2 * c];
+            im += static_cast<PetscReal>( v[c] ) * x[2 * c + 1];
+        }
+        return PetscScalar( re, im );
+    }
+    static PetscScalar
+    dot( const std::complex<float>* v, const PetscScalar* x, PetscInt n )
+    {
+        PetscScalar sum = 0;
+        for ( PetscInt c = 0; c < n; ++c )
+            sum += static_cast<PetscScalar>( v[c] ) * x[c];
+        return sum;
+    }
+
+    static PetscReal widen( PetscReal v ) { return v; }
+    static PetscReal widen( float v ) { return v; }
+    static PetscScalar widen( PetscScalar v ) { return v; }
+    static PetscScalar widen( std::complex<float> v )
+    {
+        return static_cast<PetscScalar>( v );
+    }
+
+    static Value value( PetscScalar v, std::true_type /*real*/ )
+    {
+        if ( v.imag() != 0. )
+            throw std::domain_error(
+                "BlockDipole: complex value in a real dipole matrix" );
+        return static_cast<Value>( v.real() );
+    }
+    static Value value( PetscScalar v, std::false_type /*real*/ )
+    {
+        return static_cast<Value>( v );
+    }
+
+    std::vector<Block> blocks;
+    // the l of the rows and the columns of each block
+    std::vector<std::array<size_t, 2>> block_l;
+    std::vector<PetscInt> offsets;
+    mutable std::vector<PetscInt> active;
+    MPI_Comm comm;
+    PetscInt size_;
+    PetscInt rowstart;
+    PetscInt rowend;
+    PetscInt colstart;
+    PetscInt colend;
+    Vec xlocal;
+    VecScatter scatter;
+    // for apply_block
+    mutable std::vector<Vec> xlocals;
+    mutable std::vector<PetscScalar> xi;
+};
+
+// true if every element of D is real (on every rank).
+inline bool is_real( const petsc::Matrix& D )
+{
+    PetscInt rowstart, rowend;
+    MatGetOwnershipRange( D.m_, &rowstart, &rowend );
+    int real = 1;
+    for ( PetscInt i = rowstart; i < rowend && real; ++i ) {
+        PetscInt ncols;
+        const PetscInt* cols;
+        const PetscScalar* vals;
+        MatGetRow( D.m_, i, &ncols, &cols, &vals );
+        for ( PetscInt k = 0; k < ncols; ++k )
+            if ( vals[k].imag() != 0. ) real = 0;
+        MatRestoreRow( D.m_, i, &ncols, &cols, &vals );
+    }
+    int all_real;
+    MPI_Allreduce( &real, &all_real, 1, MPI_INT, MPI_MIN, D.comm() );
+    return all_real;
+}
+
+// the cheapest block operator for D: real storage if D is real (no ecs),
+// complex otherwise.  single stores the values in single precision.
+inline std::unique_ptr<DipoleOperator>
+make_block_dipole( const petsc::Matrix& D,
+                   const std::vector<BasisID>& prototype,
+                   bool single = false )
+{
+    using namespace std;
+    bool real = is_real( D );
+    if ( real && single )
+        return unique_ptr<DipoleOperator>(
+            new BlockDipole<float>( D, prototype ) );
+    else if ( real )
+        return unique_ptr<DipoleOperator>(
+            new BlockDipole<PetscReal>( D, prototype ) );
+    else if ( single )
+        return unique_ptr<DipoleOperator>(
+            new BlockDipole<complex<float>>( D, prototype ) );
+    else
+        return unique_ptr<DipoleOperator>(
+            new BlockDipole<PetscScalar>( D, prototype ) );
+}
+
+// |A x - B x| / |B x|, to see what a cheaper representation A of B costs in
+// accuracy.
+inline double relative_difference( const DipoleOperator& A,
+                                   const DipoleOperator& B,
+                                   const petsc::Vector& x )
+{
+    auto ax = x.duplicate();
+    auto bx = x.duplicate();
+    A.mult( x, ax );
+    B.mult( x, bx );
+    double norm = bx.norm();
+    ax -= bx;
+    return norm == 0 ? ax.norm() : ax.norm() / norm;
+}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/observables.hpp>
+#include <time_dependent/hamiltonian_operator.hpp>
+
+namespace Erwin
+{
+
+/*
+ * Once the field is zero, -i H0 (with whatever the observers did to it, like
+ * the absorber) is diagonal, so a step is just
+ *
+ *     psi(t + dt) = exp(dt diag(A)) psi(t),
+ *
+ * exact, with no solves and no dipole products.  We still go step by step
+ * so the observers see the same samples they would otherwise.
+ */
+struct FieldFreeStepper final : Stepper {
+    FieldFreeStepper( HamiltonianOperator& op_,
+                      const std::vector<petsc::Vector>& psi,
+                      double ti,
+                      int step )
+        : op( op_ ), exponent( psi.front().duplicate() ), t( ti ),
+          step_( step )
+    {
+        for ( auto& p : psi ) previous.push_back( p.duplicate() );
+    }
+
+    double time() const { return t; }
+    double dt() const { return dt_; }
+    int step() const { return step_; }
+    void select( size_t column_ ) { column = column_; }
+    petsc::Vector interpolate( double tt )
+    {
+        auto v = previous[column].duplicate();
+        auto e = exponent.duplicate();
+        op.diagonal( e.v_ );
+        VecScale( e.v_, tt - ( t - dt_ ) );
+        VecExp( e.v_ );
+        VecPointwiseMult( v.v_, e.v_, previous[column].v_ );
+        return v;
+    }
+
+    // psi <- exp(dt diag(A)) psi, for the operator as it is now
+    void advance( std::vector<petsc::Vector>& psi, double dt )
+    {
+        op.diagonal( exponent.v_ );
+        VecScale( exponent.v_, dt );
+        VecExp( exponent.v_ );
+        for ( auto k = 0u; k < psi.size(); ++k ) {
+            VecCopy( psi[k].v_, previous[k].v_ );
+            VecPointwiseMult( psi[k].v_, exponent.v_, psi[k].v_ );
+        }
+        t += dt;
+        dt_ = dt;
+        step_++;
+    }
+
+  private:
+    HamiltonianOperator& op;
+    std::vector<petsc::Vector> previous;
+    size_t column{0};
+    petsc::Vector exponent;
+    double t;
+    double dt_{0};
+    int step_;
+};
+}
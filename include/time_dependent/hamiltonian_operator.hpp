@@ -0,0 +1,268 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/dipole_operator.hpp>
+#include <vector>
+
+namespace Erwin
+{
+
+/*
+ * The time dependent Hamiltonian -i (H0 + E(t) D) as a shell matrix:
+ *
+ *     y = shift x + scale L (H0 + E D) R x
+ *
+ * where H0 is the (diagonal) field free Hamiltonian, D is applied through a
+ * DipoleOperator, and E is just a number.  Setting the field is all it takes
+ * to move to a new time; nothing is copied or assembled.
+ *
+ * scale, shift and the diagonal scalings L and R are whatever the time
+ * stepper (MatScale/MatShift to form the implicit system) and the observers
+ * (MatDiagonalScale for the absorber) do to the operator after set_field().
+ *
+ * The dipole matrix has no diagonal (the l -> l +/- 1 selection rule), so
+ * the diagonal of the operator is just shift + scale L H0 R, which is what
+ * the diagonal preconditioner inverts.
+ *
+ * With coupling_only, H0 is left out: -i E(t) D, for propagators that take
+ * care of the field free part themselves.
+ */
+struct HamiltonianOperator {
+    HamiltonianOperator( const DipoleOperator& D_,
+                         const petsc::Vector& H0_,
+                         bool coupling_only_ = false )
+        : D( D_ ), H0( H0_ ), coupling_only( coupling_only_ )
+    {
+        VecDuplicate( H0.v_, &work );
+    }
+
+    HamiltonianOperator( const HamiltonianOperator& ) = delete;
+    HamiltonianOperator& operator=( const HamiltonianOperator& ) = delete;
+
+    ~HamiltonianOperator()
+    {
+        VecDestroy( &work );
+        if ( left ) VecDestroy( &left );
+        if ( right ) VecDestroy( &right );
+        if ( inverse_diagonal ) VecDestroy( &inverse_diagonal );
+    }
+
+    // -i (H0 + efield D), forgetting any previous scaling
+    void set_field( double efield_ )
+    {
+        efield = efield_;
+        scale = PetscScalar( 0, -1 );
+        shift = 0;
+        if ( left ) VecDestroy( &left );
+        if ( right ) VecDestroy( &right );
+        left = right = PETSC_NULL;
+    }
+    // just the field, keeping the scaling (for several fields in one step)
+    void change_field( double efield_ ) { efield = efield_; }
+    double field() const { return efield; }
+
+    // the parts of shift + scale L (H0 + E D) R, for solvers that need more
+    // than products (L and R are null until something scales by them).
+    PetscScalar get_scale() const { return scale; }
+    PetscScalar get_shift() const { return shift; }
+    Vec get_left() const { return left; }
+    Vec get_right() const { return right; }
+
+    void apply( Vec x, Vec y ) const
+    {
+        Vec xr = x;
+        if ( right ) {
+            VecPointwiseMult( work, right, x );
+            xr = work;
+        }
+        D.apply( xr, y );
+
+        PetscInt n;
+        VecGetLocalSize( y, &n );
+        const PetscScalar *xa, *xra, *h;
+        PetscScalar* ya;
+        VecGetArrayRead( x, &xa );
+        VecGetArrayRead( xr, &xra );
+        VecGetArrayRead( H0.v_, &h );
+        VecGetArray( y, &ya );
+        if ( coupling_only )
+            for ( PetscInt i = 0; i < n; ++i ) ya[i] *= scale * efield;
+        else
+            for ( PetscInt i = 0; i < n; ++i )
+                ya[i] = scale * ( h[i] * xra[i] + efield * ya[i] );
+        VecRestoreArray( y, &ya );
+        VecRestoreArrayRead( H0.v_, &h );
+        VecRestoreArrayRead( xr, &xra );
+        if ( left ) VecPointwiseMult( y, left, y );
+        if ( shift != 0. ) {
+            VecGetArray( y, &ya );
+            for ( PetscInt i = 0; i < n; ++i ) ya[i] += shift * xa[i];
+            VecRestoreArray( y, &ya );
+        }
+        VecRestoreArrayRead( x, &xa );
+    }
+
+    // y[k] = A x[k], with one pass over D for the whole block
+    void apply_block( const std::vector<Vec>& x,
+                      const std::vector<Vec>& y ) const
+    {
+        if ( right || x.size() == 1 ) {
+            for ( auto k = 0u; k < x.size(); ++k ) apply( x[k], y[k] );
+            return;
+        }
+        D.apply_block( x, y );
+        PetscInt n;
+        VecGetLocalSize( H0.v_, &n );
+        const PetscScalar* h;
+        VecGetArrayRead( H0.v_, &h );
+        for ( auto k = 0u; k < x.size(); ++k ) {
+            const PetscScalar* xa;
+            PetscScalar* ya;
+            VecGetArrayRead( x[k], &xa );
+            VecGetArray( y[k], &ya );
+            for ( PetscInt i = 0; i < n; ++i )
+                ya[i] = scale * ( ( coupling_only ? 0. : h[i] * xa[i] ) +
+                                  efield * ya[i] );
+            VecRestoreArray( y[k], &ya );
+            VecRestoreArrayRead( x[k], &xa );
+            if ( left ) VecPointwiseMult( y[k], left, y[k] );
+            if ( shift != 0. ) VecAXPY( y[k], shift, x[k] );
+        }
+        VecRestoreArrayRead( H0.v_, &h );
+    }
+
+    void diagonal( Vec d ) const
+    {
+        if ( coupling_only ) {
+            VecSet( d, shift );
+            return;
+        }
+        VecCopy( H0.v_, d );
+        VecScale( d, scale );
+        if ( left ) VecPointwiseMult( d, left, d );
+        if ( right ) VecPointwiseMult( d, right, d );
+        VecShift( d, shift );
+    }
+
+    // the shell matrix, which refers to this object, so it can't outlive it.
+    petsc::Matrix as_matrix() const
+    {
+        PetscInt n, N;
+        VecGetLocalSize( H0.v_, &n );
+        VecGetSize( H0.v_, &N );
+        Mat m;
+        MatCreateShell( H0.comm(), n, n, N, N,
+                        const_cast<HamiltonianOperator*>( this ), &m );
+        MatShellSetOperation(
+            m, MATOP_MULT,
+            reinterpret_cast<void ( * )( void )>( &shell_mult ) );
+        MatShellSetOperation(
+            m, MATOP_SCALE,
+            reinterpret_cast<void ( * )( void )>( &shell_scale ) );
+        MatShellSetOperation(
+            m, MATOP_SHIFT,
+            reinterpret_cast<void ( * )( void )>( &shell_shift ) );
+        MatShellSetOperation(
+            m, MATOP_DIAGONAL_SCALE,
+            reinterpret_cast<void ( * )( void )>( &shell_diagonal_scale ) );
+        MatShellSetOperation(
+            m, MATOP_GET_DIAGONAL,
+            reinterpret_cast<void ( * )( void )>( &shell_get_diagonal ) );
+        return petsc::Matrix( m );
+    }
+
+    // use the inverse of the diagonal (of whatever the solver's operator is
+    // by then) as the preconditioner for ksp.  H0 dominates the diagonal,
+    // so for the Crank-Nicolson system this is the field free solve.
+    void precondition( KSP ksp ) const
+    {
+        PC pc;
+        KSPGetPC( ksp, &pc );
+        PCSetType( pc, PCSHELL );
+        PCShellSetContext( pc, const_cast<HamiltonianOperator*>( this ) );
+        PCShellSetSetUp( pc, &pc_setup );
+        PCShellSetApply( pc, &pc_apply );
+        PCShellSetName( pc, "diagonal of -i(H0 + E(t) D)" );
+    }
+
+  private:
+    static HamiltonianOperator* context( Mat m )
+    {
+        HamiltonianOperator* self;
+        MatShellGetContext( m, &self );
+        return self;
+    }
+
+    static PetscErrorCode shell_mult( Mat m, Vec x, Vec y )
+    {
+        context( m )->apply( x, y );
+        return 0;
+    }
+    static PetscErrorCode shell_scale( Mat m, PetscScalar a )
+    {
+        auto self = context( m );
+        self->scale *= a;
+        self->shift *= a;
+        return 0;
+    }
+    static PetscErrorCode shell_shift( Mat m, PetscScalar a )
+    {
+        context( m )->shift += a;
+        return 0;
+    }
+    // L and R are applied before the shift, so they have to come first:
+    static PetscErrorCode shell_diagonal_scale( Mat m, Vec l, Vec r )
+    {
+        auto self = context( m );
+        if ( self->shift != 0. ) return PETSC_ERR_SUP;
+        if ( l ) self->accumulate( self->left, l );
+        if ( r ) self->accumulate( self->right, r );
+        return 0;
+    }
+    static PetscErrorCode shell_get_diagonal( Mat m, Vec d )
+    {
+        context( m )->diagonal( d );
+        return 0;
+    }
+
+    static PetscErrorCode pc_setup( PC pc )
+    {
+        HamiltonianOperator* self;
+        PCShellGetContext( pc, &self );
+        Mat A;
+        PCGetOperators( pc, &A, PETSC_NULL );
+        if ( !self->inverse_diagonal )
+            VecDuplicate( self->H0.v_, &self->inverse_diagonal );
+        MatGetDiagonal( A, self->inverse_diagonal );
+        VecReciprocal( self->inverse_diagonal );
+        return 0;
+    }
+    static PetscErrorCode pc_apply( PC pc, Vec x, Vec y )
+    {
+        HamiltonianOperator* self;
+        PCShellGetContext( pc, &self );
+        VecPointwiseMult( y, self->inverse_diagonal, x );
+        return 0;
+    }
+
+    void accumulate( Vec& into, Vec v )
+    {
+        if ( !into ) {
+            VecDuplicate( v, &into );
+            VecCopy( v, into );
+        } else
+            VecPointwiseMult( into, into, v );
+    }
+
+    const DipoleOperator& D;
+    const petsc::Vector& H0;
+    const bool coupling_only;
+    double efield{0};
+    PetscScalar scale{0, -1};
+    PetscScalar shift{0};
+    Vec left{PETSC_NULL};
+    Vec right{PETSC_NULL};
+    mutable Vec work;
+    Vec inverse_diagonal{PETSC_NULL};
+};
+}
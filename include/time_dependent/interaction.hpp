@@ -0,0 +1,107 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/observables.hpp>
+#include <time_dependent/krylov.hpp>
+
+namespace Erwin
+{
+
+/*
+ * Propagation in the interaction picture of the (diagonal) field free
+ * Hamiltonian.  Over one step, with the field at the middle of the step,
+ *
+ *     psi(t + dt) = P(dt/2) exp(-i E D dt) P(dt/2) psi(t),
+ *     P(tau) = exp(-i H0 tau),
+ *
+ * which is the midpoint rule for c(t) = exp(i H0 t) psi(t) rotated back to
+ * the schrodinger picture at the end of every step.  The phases (and the ecs
+ * decay) of H0 are exact, so only the coupling -i E D has to be resolved by
+ * the krylov space, and the step is limited by |E D| dt rather than by the
+ * largest energy in the basis.
+ *
+ * The picture is re-anchored every step, so exp(i H0 tau) is never formed
+ * for more than half a step, and the decaying (complex energy) states
+ * can't overflow.
+ */
+struct InteractionStepper final : Stepper {
+    InteractionStepper( KrylovExponential& expo_,
+                        const HamiltonianOperator& coupling_,
+                        const petsc::Vector& H0_,
+                        const std::vector<petsc::Vector>& psi,
+                        double ti,
+                        int step = 0 )
+        : expo( expo_ ), coupling( coupling_ ), H0( H0_ ),
+          phase( H0.duplicate() ), t( ti ), step_( step )
+    {
+        for ( auto& p : psi ) previous.push_back( p.duplicate() );
+    }
+
+    double time() const { return t; }
+    double dt() const { return dt_; }
+    int step() const { return step_; }
+    void select( size_t column_ ) { column = column_; }
+    petsc::Vector interpolate( double tt )
+    {
+        auto v = previous[column].duplicate();
+        VecCopy( previous[column].v_, v.v_ );
+        auto p = phase.duplicate();
+        auto tau = tt - ( t - dt_ );
+        phases( p, tau / 2 );
+        VecPointwiseMult( v.v_, p.v_, v.v_ );
+        expo.apply( coupling, v.v_, tau );
+        VecPointwiseMult( v.v_, p.v_, v.v_ );
+        return v;
+    }
+
+    // back to t and step, to take the last step(s) again (psi is the
+    // caller's to put back)
+    void reset( double t_, int step__ )
+    {
+        t = t_;
+        step_ = step__;
+        dt_ = 0;
+    }
+
+    // psi <- P(dt/2) exp(-i E D dt) P(dt/2) psi
+    void advance( std::vector<petsc::Vector>& psi, double dt )
+    {
+        if ( dt != phase_dt ) {
+            phases( phase, dt / 2 );
+            phase_dt = dt;
+        }
+        std::vector<Vec> v;
+        for ( auto k = 0u; k < psi.size(); ++k ) {
+            VecCopy( psi[k].v_, previous[k].v_ );
+            VecPointwiseMult( psi[k].v_, phase.v_, psi[k].v_ );
+            v.push_back( psi[k].v_ );
+        }
+        expo.apply( coupling, v, dt );
+        for ( auto& p : psi ) VecPointwiseMult( p.v_, phase.v_, p.v_ );
+        t += dt;
+        dt_ = dt;
+        step_++;
+    }
+
+  private:
+    // p = exp(-i H0 tau)
+    void phases( petsc::Vector& p, double tau ) const
+    {
+        VecCopy( H0.v_, p.v_ );
+        VecScale( p.v_, PetscScalar( 0, -tau ) );
+        VecExp( p.v_ );
+    }
+
+    KrylovExponential& expo;
+    const HamiltonianOperator& coupling;
+    const petsc::Vector& H0;
+    std::vector<petsc::Vector> previous;
+    size_t column{0};
+    // exp(-i H0 dt / 2) for the current dt
+    petsc::Vector phase;
+    double phase_dt{0};
+    double t;
+    double dt_{0};
+    int step_{0};
+};
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/observables.hpp>
+#include <time_dependent/hamiltonian_operator.hpp>
+#include <utilities/math.hpp>
+#include <vector>
+#include <algorithm>
+
+namespace Erwin
+{
+
+/*
+ * psi <- exp(dt A) psi, from the Krylov space { psi, A psi, A^2 psi, ... }.
+ *
+ * Arnoldi builds an orthonormal basis V_k and the small Hessenberg matrix
+ * H_k = V_k^* A V_k, and then
+ *
+ *     exp(dt A) psi ~= |psi| V_k exp(dt H_k) e_1.
+ *
+ * The space grows until the usual a posteriori estimate of the error
+ *
+ *     |psi| h_{k+1,k} |[exp(dt H_k)]_{k,1}|
+ *
+ * drops below tolerance.  If it doesn't by max_dimension, we take the
+ * largest fraction of dt (halving) that the space is good for, and start a
+ * new space from there.
+ *
+ * Only products with A are needed (anything with an apply_block, like
+ * HamiltonianOperator), so A is never assembled.  With lanczos, each vector
+ * is only orthogonalized against the last two, which is only right for
+ * (anti-)hermitian A: no ecs and no absorber.
+ */
+struct KrylovExponential {
+    KrylovExponential( const petsc::Vector& prototype,
+                       unsigned max_dimension_,
+                       double tolerance_,
+                       bool lanczos_ = false )
+        : max_dimension( max_dimension_ ), tolerance( tolerance_ ),
+          lanczos( lanczos_ )
+    {
+        if ( max_dimension < 2 )
+            throw std::invalid_argument(
+                "KrylovExponential: the dimension must be at least 2" );
+        VecDuplicate( prototype.v_, &prototype_ );
+    }
+
+    KrylovExponential( const KrylovExponential& ) = delete;
+    KrylovExponential& operator=( const KrylovExponential& ) = delete;
+
+    ~KrylovExponential()
+    {
+        for ( auto& space : V )
+            for ( auto& v : space ) VecDestroy( &v );
+        VecDestroy( &prototype_ );
+    }
+
+    // psi <- exp(dt A) psi
+    template <typename Op>
+    void apply( const Op& A, Vec psi, double dt )
+    {
+        apply( A, std::vector<Vec>{psi}, dt );
+    }
+
+    // psi[k] <- exp(dt A) psi[k].  Every column gets its own space, but they
+    // are built in lock step so that each A product is one A.apply_block
+    // over all the columns still growing their space.
+    template <typename Op>
+    void apply( const Op& A, const std::vector<Vec>& psi, double dt )
+    {
+        using namespace std;
+        const auto m = max_dimension;
+        const auto K = psi.size();
+        while ( V.size() < K ) {
+            V.emplace_back( m + 1 );
+            for ( auto& v : V.back() ) VecDuplicate( prototype_, &v );
+        }
+        dimension = 0;
+        substeps = 0;
+        error = 0;
+
+        vector<Space> spaces( K );
+        for ( auto& s : spaces ) {
+            s.remaining = dt;
+            s.h.resize( ( m + 1 ) * m );
+        }
+        vector<complex> dots( m );
+        vector<Vec> x, y;
+        vector<size_t> growing;
+        while ( true ) {
+            // a new space for every column with time left:
+            growing.clear();
+            for ( auto c = 0u; c < K; ++c ) {
+                auto& s = spaces[c];
+                if ( s.remaining <= 0 ) continue;
+                VecNorm( psi[c], NORM_2, &s.beta );
+                if ( s.beta == 0 ) {
+                    s.remaining = 0;
+                    continue;
+                }
+                VecCopy( psi[c], V[c][0] );
+                VecScale( V[c][0], 1. / s.beta );
+                fill( s.h.begin(), s.h.end(), 0. );
+                s.tau = s.remaining;
+                s.k = 0;
+                s.err = 0;
+                growing.push_back( c );
+            }
+            if ( growing.empty() ) break;
+            auto started = growing;
+
+            for ( auto j = 0u; j < m && !growing.empty(); ++j ) {
+                x.clear();
+                y.clear();
+                for ( auto c : growing ) {
+                    x.push_back( V[c][j] );
+                    y.push_back( V[c][j + 1] );
+                }
+                A.apply_block( x, y );
+
+                vector<size_t> still;
+                for ( auto c : growing ) {
+                    auto& s = spaces[c];
+                    auto first = lanczos && j > 0 ? j - 1 : 0;
+                    auto count = static_cast<PetscInt>( j + 1 - first );
+                    // classical gram-schmidt, twice (one reduction per pass):
+                    for ( auto pass = 0; pass < 2; ++pass ) {
+                        VecMDot( V[c][j + 1], count, &V[c][first],
+                                 dots.data() );
+                        for ( PetscInt i = 0; i < count; ++i ) {
+                            s.h[( first + i ) * m + j] += dots[i];
+                            dots[i] = -dots[i];
+                        }
+                        VecMAXPY( V[c][j + 1], count, dots.data(),
+                                  &V[c][first] );
+                    }
+                    PetscReal hnext;
+                    VecNorm( V[c][j + 1], NORM_2, &hnext );
+                    s.h[( j + 1 ) * m + j] = hnext;
+                    s.k = j + 1;
+                    // a happy breakdown: the space is invariant, so it is
+                    // exact
+                    if ( hnext <= 1e-14 * s.beta ) {
+                        exponentiate( s, 0 );
+                        continue;
+                    }
+                    exponentiate( s, hnext );
+                    VecScale( V[c][j + 1], 1. / hnext );
+                    if ( s.err > tolerance ) still.push_back( c );
+                }
+                growing = still;
+            }
+
+            for ( auto c : started ) {
+                auto& s = spaces[c];
+                while ( s.err > tolerance ) {
+                    s.tau /= 2;
+                    exponentiate( s, abs( s.h[s.k * m + s.k - 1] ) );
+                }
+                for ( auto i = 0u; i < s.k; ++i )
+                    dots[i] = s.beta * s.E[i * s.k];
+                VecSet( psi[c], 0. );
+                VecMAXPY( psi[c], static_cast<PetscInt>( s.k ), dots.data(),
+                          V[c].data() );
+
+                s.remaining -= s.tau;
+                dimension = max( dimension, s.k );
+                substeps++;
+                error = max( error, s.err );
+            }
+        }
+    }
+
+    // for the last apply: the largest space used, how many spaces it took
+    // (over all columns), and the largest estimated error of any of them.
+    unsigned dimension{0};
+    unsigned substeps{0};
+    double error{0};
+
+  private:
+    typedef std::complex<double> complex;
+    struct Space {
+        double remaining;
+        double tau;
+        PetscReal beta;
+        unsigned k;
+        double err;
+        // the (m + 1) x m hessenberg matrix, row major:
+        std::vector<complex> h;
+        // exp(tau H_k)
+        std::vector<complex> E;
+    };
+
+    // exp(tau H_k) and its error estimate
+    void exponentiate( Space& s, double hnext ) const
+    {
+        const auto m = max_dimension;
+        const auto k = s.k;
+        std::vector<complex> Hk( k * k );
+        for ( auto i = 0u; i < k; ++i )
+            for ( auto j = 0u; j < k; ++j )
+                Hk[i * k + j] = s.tau * s.h[i * m + j];
+        s.E = math::expm( Hk, k );
+        s.err = s.beta * hnext * std::abs( s.E[( k - 1 ) * k] );
+    }
+
+    const unsigned max_dimension;
+    const double tolerance;
+    const bool lanczos;
+    Vec prototype_;
+    // one space per column
+    std::vector<std::vector<Vec>> V;
+};
+
+// The clock for a propagator that does its own stepping by exponentials,
+// psi(t + dt) = exp(dt A) psi(t), for one or more columns.  Inside a step,
+// the state is the same exponential over part of the step; interpolate()
+// is for the column picked by select().  Exponential is KrylovExponential,
+// or anything else with the same apply()s.
+template <typename Exponential = KrylovExponential>
+struct ExponentialStepper final : Stepper {
+    ExponentialStepper( Exponential& expo_,
+                        const HamiltonianOperator& A_,
+                        const std::vector<petsc::Vector>& psi,
+                        double ti,
+                        int step = 0 )
+        : expo( expo_ ), A( A_ ), t( ti ), step_( step )
+    {
+        for ( auto& p : psi ) previous.push_back( p.duplicate() );
+    }
+
+    double time() const { return t; }
+    double dt() const { return dt_; }
+    int step() const { return step_; }
+    void select( size_t column_ ) { column = column_; }
+    petsc::Vector interpolate( double tt )
+    {
+        auto v = previous[column].duplicate();
+        VecCopy( previous[column].v_, v.v_ );
+        expo.apply( A, v.v_, tt - ( t - dt_ ) );
+        return v;
+    }
+
+    // back to t and step, to take the last step(s) again (psi is the
+    // caller's to put back)
+    void reset( double t_, int step__ )
+    {
+        t = t_;
+        step_ = step__;
+        dt_ = 0;
+    }
+
+    // psi <- exp(dt A) psi
+    void advance( std::vector<petsc::Vector>& psi, double dt )
+    {
+        std::vector<Vec> v;
+        for ( auto k = 0u; k < psi.size(); ++k ) {
+            VecCopy( psi[k].v_, previous[k].v_ );
+            v.push_back( psi[k].v_ );
+        }
+        expo.apply( A, v, dt );
+        t += dt;
+        dt_ = dt;
+        step_++;
+    }
+
+  private:
+    Exponential& expo;
+    const HamiltonianOperator& A;
+    std::vector<petsc::Vector> previous;
+    size_t column{0};
+    double t;
+    double dt_{0};
+    int step_{0};
+};
+}
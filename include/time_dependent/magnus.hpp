@@ -0,0 +1,110 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/observables.hpp>
+#include <time_dependent/hamiltonian_operator.hpp>
+#include <time_dependent/krylov.hpp>
+#include <functional>
+#include <cmath>
+
+namespace Erwin
+{
+
+/*
+ * Commutator free magnus integrators, out of krylov exponentials.
+ *
+ * Order 4 (CF4, Blanes & Moan): with A_j = A(t + c_j dt) at the two gauss
+ * nodes c = 1/2 -/+ sqrt(3)/6,
+ *
+ *     psi(t + dt) = exp(dt (a1 A_1 + a2 A_2)) exp(dt (a2 A_1 + a1 A_2)) psi,
+ *     a1 = (3 - 2 sqrt(3)) / 12,  a2 = (3 + 2 sqrt(3)) / 12.
+ *
+ * A(t) = -i (H0 + E(t) D) is linear in E, and a1 + a2 = 1/2, so each of the
+ * exponentials is just exp(dt/2 A) at an averaged field.
+ *
+ * Order 6: CF4 is time symmetric, so the triple jump (Yoshida) of it,
+ * steps of g1 dt, g2 dt, g1 dt with g1 = 1 / (2 - 2^(1/5)) and
+ * g2 = 1 - 2 g1, is order 6.  The middle step goes backwards in time, which
+ * grows the decaying (ecs, absorbed) part of the wavefunction for a while.
+ *
+ * Whatever scaling the observers put on the operator (the absorber) is kept
+ * for every exponential of the step.
+ */
+struct MagnusStepper final : Stepper {
+    MagnusStepper( KrylovExponential& expo_,
+                   HamiltonianOperator& A_,
+                   std::function<double(double)> efield_,
+                   unsigned order_,
+                   const std::vector<petsc::Vector>& psi,
+                   double ti,
+                   int step = 0 )
+        : expo( expo_ ), A( A_ ), efield( efield_ ), order( order_ ), t( ti ),
+          step_( step )
+    {
+        if ( order != 4 && order != 6 )
+            throw std::invalid_argument(
+                "MagnusStepper: the order must be 4 or 6" );
+        for ( auto& p : psi ) previous.push_back( p.duplicate() );
+    }
+
+    double time() const { return t; }
+    double dt() const { return dt_; }
+    int step() const { return step_; }
+    void select( size_t column_ ) { column = column_; }
+    // the same integrator, over part of the last step
+    petsc::Vector interpolate( double tt )
+    {
+        auto v = previous[column].duplicate();
+        VecCopy( previous[column].v_, v.v_ );
+        integrate( {v.v_}, t - dt_, tt - ( t - dt_ ) );
+        return v;
+    }
+
+    void advance( std::vector<petsc::Vector>& psi, double dt )
+    {
+        std::vector<Vec> v;
+        for ( auto k = 0u; k < psi.size(); ++k ) {
+            VecCopy( psi[k].v_, previous[k].v_ );
+            v.push_back( psi[k].v_ );
+        }
+        integrate( v, t, dt );
+        t += dt;
+        dt_ = dt;
+        step_++;
+    }
+
+  private:
+    void integrate( const std::vector<Vec>& v, double t0, double h )
+    {
+        if ( order == 4 ) return cf4( v, t0, h );
+        const double g1 = 1. / ( 2. - std::pow( 2., 1. / 5. ) );
+        const double g2 = 1. - 2. * g1;
+        cf4( v, t0, g1 * h );
+        cf4( v, t0 + g1 * h, g2 * h );
+        cf4( v, t0 + ( g1 + g2 ) * h, g1 * h );
+    }
+
+    void cf4( const std::vector<Vec>& v, double t0, double h )
+    {
+        const double r = std::sqrt( 3. );
+        const double c1 = .5 - r / 6., c2 = .5 + r / 6.;
+        const double a1 = ( 3. - 2. * r ) / 12., a2 = ( 3. + 2. * r ) / 12.;
+        const auto e1 = efield( t0 + c1 * h ), e2 = efield( t0 + c2 * h );
+        // the right exponential first:
+        A.change_field( 2. * ( a2 * e1 + a1 * e2 ) );
+        expo.apply( A, v, h / 2. );
+        A.change_field( 2. * ( a1 * e1 + a2 * e2 ) );
+        expo.apply( A, v, h / 2. );
+    }
+
+    KrylovExponential& expo;
+    HamiltonianOperator& A;
+    const std::function<double(double)> efield;
+    const unsigned order;
+    std::vector<petsc::Vector> previous;
+    size_t column{0};
+    double t;
+    double dt_{0};
+    int step_{0};
+};
+}
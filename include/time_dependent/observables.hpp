@@ -1,5 +1,7 @@
 #pragma once
 #include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/reductions.hpp>
+#include <iosfwd>
 
 namespace Erwin
 {
@@ -19,7 +21,7 @@ namespace Erwin
   //           absorber mask
   //           eigenstate mask
   void
-  Observable::operator()(Matrix& A, Vector& U, TimeStepper& ts);
+  Observable::operator()(Matrix& A, Vector& U, Stepper& ts);
 
   //For monitoring (run during the monitor stage:)
   string
@@ -40,9 +42,77 @@ namespace Erwin
       cout << O.name << ": " << O.last() << ", ";
  */
 
+// Where the propagation is at, for the observers.  petsc's TimeStepper is
+// one of these (TSStepper), the propagators that do their own stepping are
+// the others.
+struct Stepper {
+    virtual double time() const = 0;
+    virtual double dt() const = 0;
+    virtual int step() const = 0;
+    // the state at time t, somewhere within the last step
+    virtual petsc::Vector interpolate( double t ) = 0;
+    // where the last step started, so where interpolate starts being one
+    virtual double step_start() const { return time() - dt(); }
+    // which wavefunction interpolate() is for, if there are several
+    virtual void select( size_t ) {}
+    virtual ~Stepper() = default;
+};
+
+struct TSStepper final : Stepper {
+    TSStepper( petsc::TimeStepper& ts_ ) : ts( ts_ ) {}
+    double time() const { return ts.time(); }
+    double dt() const { return ts.dt(); }
+    int step() const { return ts.step(); }
+    petsc::Vector interpolate( double t ) { return ts.interpolate( t ); }
+
+  private:
+    petsc::TimeStepper& ts;
+};
+
+// A point on the sample grid ti + n dt, somewhere within the last step of
+// an (adaptive) stepper.  The observers see the grid, not the steps.
+struct SampleStepper final : Stepper {
+    SampleStepper( Stepper& s_, double t_, double dt__, int step__ )
+        : s( s_ ), t( t_ ), dt_( dt__ ), step_( step__ )
+    {
+    }
+    double time() const { return t; }
+    double dt() const { return dt_; }
+    int step() const { return step_; }
+    petsc::Vector interpolate( double tt ) { return s.interpolate( tt ); }
+    // the step's, not the grid's: adaptive steps can be shorter than dt
+    double step_start() const { return s.step_start(); }
+
+  private:
+    Stepper& s;
+    double t;
+    double dt_;
+    int step_;
+};
+
 struct Observable {
-    virtual void operator()(const petsc::Matrix& A, const petsc::Vector& U, petsc::TimeStepper& ts) = 0;
-    virtual void modify(petsc::Matrix& A, petsc::Vector& U, petsc::Vector& F, petsc::TimeStepper& ts) = 0;
+    virtual void operator()(const petsc::Matrix& A, const petsc::Vector& U, Stepper& ts) = 0;
+    virtual void modify(petsc::Matrix& A, petsc::Vector& U, petsc::Vector& F, Stepper& ts) = 0;
+    // after every step, for observers that change the state itself (see
+    // MaskAbsorber)
+    virtual void after_step( petsc::Vector&, Stepper& ) {}
+    // whether modify changes the operator, which not every propagator can
+    // take (see Propagator::register_observable)
+    virtual bool modifies_operator() const { return false; }
+    // observers that need sums over every rank (inner products, norms) add
+    // them to R here instead of summing each one in operator(): the sums
+    // of all the observers are done together, and handed back to reduced,
+    // by the next sample at the latest (see Reductions)
+    virtual void request( Reductions&, const petsc::Vector&, Stepper& ) {}
+    virtual void reduced( const Reductions& ) {}
+    // checkpoints: write what it takes to carry on from here (with the
+    // outputs flushed), and read it back, with the outputs cut back to
+    // where they were then (see Propagator::checkpoint)
+    virtual void save( std::ostream& ) {}
+    virtual void restore( std::istream& ) {}
+    // a restart with no checkpoint to go on from starts over: the outputs
+    // are cut back to their headers
+    virtual void rewind() {}
     virtual std::string last() const = 0;
     virtual std::string name() const = 0;
     virtual ~Observable();
@@ -3,89 +3,715 @@
 #include <petsc_cpp/Petsc.hpp>
 #include <parameters/propagate.hpp>
 #include <time_dependent/observables.hpp>
+#include <time_dependent/hamiltonian_operator.hpp>
+#include <time_dependent/krylov.hpp>
+#include <time_dependent/interaction.hpp>
+#include <time_dependent/field_free.hpp>
+#include <time_dependent/magnus.hpp>
+#include <time_dependent/chebyshev.hpp>
+#include <time_dependent/active_space.hpp>
+#include <time_dependent/block_tridiagonal.hpp>
+#include <limits>
+#include <experimental/optional>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
 
 namespace Erwin
 {
 
 struct Propagator {
     template <typename E>
-    Propagator( petsc::Matrix& Dipole_,
+    Propagator( const DipoleOperator& Dipole_,
                 petsc::Vector& H0_,
-                petsc::TimeStepper::times tt,
+                const PropagationParameters& parameters_,
                 E& ef )
-        : Dipole( Dipole_ ), H( Dipole.get_empty_matrix() ), H0( H0_ ),
-          observables(), ts( [this, &ef]( petsc::Vector& U,
-                                          petsc::Matrix& A,
-                                          petsc::Matrix& B,
-                                          petsc::TimeStepper& T,
-                                          double t ) {
-                                 A = this->Dipole;
-                                 A *= ef( t );
-                                 A += this->H0;
-                                 A *= std::complex<double>( 0, -1 );
-                                 B.shallow_copy(A);
-
-                                 for ( auto& o : this->observables )
-                                     o->modify( A, U, U, T );
-                             },
-                             H,
-                             tt,
-                             TSTHETA )
-    {
-        H.assemble();
-        H = this->Dipole;
-        H *= ef( tt.ti );
-        H += this->H0;
-        H *= std::complex<double>( 0, -1 );
-        ts.set_monitor( [ over = this, tt ]( petsc::TimeStepper & T, int step,
-                                             double t,
-                                             const petsc::Vector& U ) {
-            static petsc::Draw draw = [&]() {
-                petsc::Draw dr( 0, U.size(), -100, 0, 1, U.comm() );
-                dr.set_function( []( PetscScalar d, unsigned ) {
-                    auto x = std::pow( std::abs( d ), 2 );
-                    return x == 0.0 ? -30 : std::log10( x );
-                } );
-                dr.set_title( "wavefunction propability" );
-                return dr;
-            }();
-            auto norm = U.norm() - 1;
-            if ( !draw.rank() )
-                std::printf( "t: %8.3f step: %8i norm-1: %8.3e ", t, step,
-                             norm );
-            for ( auto& o : over->observables ) ( *o )( over->H, U, T );
-            for ( auto& o : over->observables )
-                if ( !draw.rank() )
-                    std::printf( "%s: %s ", o->name().c_str(),
-                                 o->last().c_str() );
-            if ( !draw.rank() ) cout << endl;
-            draw.draw_vector( U );
+        : Dipole( Dipole_ ), H0( H0_ ), parameters( parameters_ ),
+          efield( ef ), op( Dipole, H0 ), H( op.as_matrix() ), observables( 1 ),
+          ts( [this]( petsc::Vector& U,
+                      petsc::Matrix& A,
+                      petsc::Matrix&,
+                      petsc::TimeStepper& T,
+                      double t ) {
+                  // A is the shell for op (as is B):
+                  const auto e = this->efield( t );
+                  const auto lag = this->lagging( e, T.dt() );
+                  KSP ksp;
+                  TSGetKSP( T.ts_, &ksp );
+                  KSPSetReusePreconditioner( ksp, lag ? PETSC_TRUE
+                                                      : PETSC_FALSE );
+                  // petsc has undone its shift and scale, so op is what it
+                  // was for the lagged field:
+                  if ( lag && !this->parameters.lag_correct ) return;
+
+                  this->op.set_field( e );
+                  if ( this->active ) this->active->update( {U.v_} );
+
+                  TSStepper clock( T );
+                  for ( auto& o : this->observables[0] )
+                      o->modify( A, U, U, clock );
+              },
+              H,
+              parameters.time(),
+              TSTHETA )
+    {
+        op.set_field( efield( parameters.ti ) );
+        if ( parameters.active_threshold > 0 )
+            active.reset( new ActiveSpace( Dipole, parameters.active_threshold,
+                                           parameters.active_margin,
+                                           H0.comm() ) );
+        KSP ksp;
+        TSGetKSP( ts.ts_, &ksp );
+        // the diagonal preconditioner, unless one was asked for:
+        const char* prefix;
+        PetscBool pc_chosen;
+        KSPGetOptionsPrefix( ksp, &prefix );
+        PetscOptionsHasName( PETSC_NULL, prefix, "-pc_type", &pc_chosen );
+        if ( !pc_chosen ) op.precondition( ksp );
+        // the jacobian is kept (as it is) between calls that don't change
+        // it, see lagging:
+        if ( parameters.lag_tolerance > 0 )
+            TSRHSJacobianSetReuse( ts.ts_, PETSC_TRUE );
+        // only E(t) changes from one step to the next, so the systems are
+        // nearly the same: keep the slowest eigenvectors deflated across
+        // solves, and start from the best combination of the last solutions.
+        if ( parameters.recycle > 0 ) {
+            KSPSetType( ksp, KSPDGMRES );
+            KSPDGMRESSetEigen( ksp,
+                               static_cast<PetscInt>( parameters.recycle ) );
+        }
+        if ( parameters.guess > 0 ) {
+            KSPGuess guess;
+            KSPGetGuess( ksp, &guess );
+            KSPGuessSetType( guess, KSPGUESSFISCHER );
+            KSPGuessFischerSetModel(
+                guess, 2, static_cast<PetscInt>( parameters.guess ) );
+        }
+        // the command line has the last word on the solver:
+        KSPSetFromOptions( ksp );
+        if ( parameters.tolerance > 0 ) {
+            // petsc's error estimate for the theta method needs the endpoint
+            // form, which is crank nicolson proper:
+            TSThetaSetEndpoint( ts.ts_, PETSC_TRUE );
+            TSAdapt adapt;
+            TSGetAdapt( ts.ts_, &adapt );
+            TSAdaptSetType( adapt, TSADAPTBASIC );
+            TSSetTolerances( ts.ts_, parameters.tolerance, PETSC_NULL, 0,
+                             PETSC_NULL );
+            TSAdaptSetStepLimits(
+                adapt, parameters.dt_min > 0 ? parameters.dt_min
+                                             : PETSC_DEFAULT,
+                parameters.dt_max > 0 ? parameters.dt_max : PETSC_DEFAULT );
+        }
+        // the observers that change the state do it after each step, which
+        // petsc leaves to a plain function: this is found on the ts.
+        PetscContainer self;
+        PetscContainerCreate( H0.comm(), &self );
+        PetscContainerSetPointer( self, this );
+        PetscObjectCompose( reinterpret_cast<PetscObject>( ts.ts_ ),
+                            "Propagator",
+                            reinterpret_cast<PetscObject>( self ) );
+        PetscContainerDestroy( &self );
+        TSSetPostStep( ts.ts_, &ts_after_step );
+        ts.set_monitor( [over = this]( petsc::TimeStepper & T, int,
+                                       double, const petsc::Vector& U ) {
+            TSStepper clock( T );
+            auto column = [&U]( size_t ) -> const petsc::Vector& {
+                return U;
+            };
+            over->sample( clock, 1, column );
         } );
     }
 
-    void register_observable( std::unique_ptr<Observable>&& O )
+    // print (and draw, for the first column) the state of a column, and
+    // hand it to the column's observers.
+    void monitor( Stepper& T,
+                  int step,
+                  double t,
+                  const petsc::Vector& U,
+                  size_t column = 0 )
+    {
+        if ( !draw ) {
+            draw.emplace( 0, U.size(), -100, 0, 1, U.comm() );
+            draw->set_function( []( PetscScalar d, unsigned ) {
+                auto x = std::pow( std::abs( d ), 2 );
+                return x == 0.0 ? -30 : std::log10( x );
+            } );
+            draw->set_title( "wavefunction propability" );
+        }
+        reported.push_back( {column, step, t, reductions.norm( U.v_ ),
+                             active ? active->active_states : 0} );
+        for ( auto& o : observables[column] ) ( *o )( H, U, T );
+        for ( auto& o : observables[column] ) o->request( reductions, U, T );
+        reductions.sweep();
+        if ( column == 0 ) draw->draw_vector( U );
+    }
+
+    // the last sample, once its sums are in (see Reductions): the observers
+    // get theirs, and the line for each column is printed.
+    void report()
+    {
+        if ( reported.empty() ) return;
+        reductions.finish();
+        int rank;
+        MPI_Comm_rank( H0.comm(), &rank );
+        for ( auto& r : reported ) {
+            for ( auto& o : observables[r.column] ) o->reduced( reductions );
+            if ( rank ) continue;
+            auto norm = std::sqrt( reductions[r.norm].real() ) - 1;
+            if ( observables.size() > 1 ) std::printf( "[%lu] ", r.column );
+            std::printf( "t: %8.3f step: %8i norm-1: %8.3e ", r.t, r.step,
+                         norm );
+            if ( active )
+                std::printf( "active: %8li ",
+                             static_cast<long>( r.active_states ) );
+            for ( auto& o : observables[r.column] )
+                std::printf( "%s: %s ", o->name().c_str(),
+                             o->last().c_str() );
+            cout << endl;
+        }
+        reported.clear();
+        reductions.clear();
+    }
+
+    // monitor every point of the sample grid ti + n dt (and tf) passed by
+    // the last step of clock, interpolating to it if need be.  columns is
+    // the number of wavefunctions, and column(k) is the k'th.
+    template <typename F>
+    void sample( Stepper& clock, size_t columns, F column )
+    {
+        const auto eps = 1e-10 * parameters.dt;
+        if ( observables.size() < columns ) observables.resize( columns );
+        while ( true ) {
+            auto t = std::min( parameters.ti + samples * parameters.dt,
+                               parameters.tf );
+            if ( t > clock.time() + eps || t <= sampled + eps ) break;
+            // the sums of the last sample have had a step to come in:
+            report();
+            for ( auto k = 0u; k < columns; ++k ) {
+                clock.select( k );
+                SampleStepper at( clock, t, parameters.dt, samples );
+                if ( std::abs( t - clock.time() ) <= eps )
+                    monitor( at, samples, t, column( k ), k );
+                else
+                    monitor( at, samples, t, clock.interpolate( t ), k );
+            }
+            reductions.start( H0.comm() );
+            sampled = t;
+            samples++;
+            if ( parameters.checkpoint_every > 0 &&
+                 samples % parameters.checkpoint_every == 0 ) {
+                report();
+                checkpoint( clock, columns, column );
+            }
+        }
+    }
+
+    // everything run needs to carry on from here, should it be stopped: the
+    // wavefunctions, the clock, the sampling and the observers (which flush
+    // their outputs and note how long they are).  The wavefunctions
+    // alternate between two sets of files, and checkpoint.config, which
+    // says which set, is replaced (renamed) last, so whatever happens
+    // there's always a whole checkpoint.
+    template <typename F>
+    void checkpoint( Stepper& clock, size_t columns, F column )
+    {
+        const auto generation = checkpoints++ % 2;
+        for ( auto k = 0u; k < columns; ++k )
+            column( k ).to_file( checkpoint_filename( generation, k ) );
+
+        std::stringstream ss;
+        ss << std::setprecision( 17 );
+        ss << generation << " " << columns << " " << clock.time() << " "
+           << clock.step() << " " << samples << " " << sampled << std::endl;
+        for ( auto k = 0u; k < columns; ++k ) {
+            for ( auto& o : observables[k] ) o->save( ss );
+            ss << std::endl;
+        }
+        int rank;
+        MPI_Comm_rank( H0.comm(), &rank );
+        if ( rank == 0 ) {
+            const auto config = parameters.folder + "/checkpoint.config";
+            std::ofstream out( config + ".tmp" );
+            out << ss.str();
+            out.close();
+            std::rename( ( config + ".tmp" ).c_str(), config.c_str() );
+        }
+    }
+
+    // carry on from the last checkpoint, if there is one (psi is
+    // overwritten, and the observers' outputs are cut back to it).  If there
+    // isn't, the run starts over from ti, and what a run killed before its
+    // first checkpoint wrote is cut, so it isn't appended to.
+    bool restore( std::vector<petsc::Vector>& psi )
     {
-        if ( O != nullptr ) observables.emplace_back( std::move( O ) );
+        std::ifstream in( parameters.folder + "/checkpoint.config" );
+        if ( !in ) {
+            for ( auto& column : observables )
+                for ( auto& o : column ) o->rewind();
+            MPI_Barrier( H0.comm() );
+            return false;
+        }
+        unsigned generation;
+        size_t columns;
+        in >> generation >> columns >> start_time >> start_step >> samples >>
+            sampled;
+        if ( columns != psi.size() )
+            throw std::invalid_argument(
+                "Propagator: the checkpoint is for another number of "
+                "wavefunctions" );
+        for ( auto k = 0u; k < columns; ++k ) {
+            auto v = petsc::binary_import_vector(
+                H0.comm(), checkpoint_filename( generation, k ) );
+            VecCopy( v.v_, psi[k].v_ );
+        }
+        if ( observables.size() < columns ) observables.resize( columns );
+        for ( auto k = 0u; k < columns; ++k )
+            for ( auto& o : observables[k] ) o->restore( in );
+        if ( !in )
+            throw std::runtime_error(
+                "Propagator: couldn't read the checkpoint (was it written "
+                "with other observers?)" );
+        checkpoints = generation + 1;
+        // every rank has cut the outputs before any goes on:
+        MPI_Barrier( H0.comm() );
+        return true;
+    }
+
+    std::string checkpoint_filename( unsigned generation, size_t k ) const
+    {
+        return parameters.folder + "/checkpoint_" +
+               std::to_string( generation ) + "_" + std::to_string( k ) +
+               ".dat";
+    }
+
+    void sample( Stepper& clock, std::vector<petsc::Vector>& psi )
+    {
+        auto column = [&psi]( size_t k ) -> const petsc::Vector& {
+            return psi[k];
+        };
+        sample( clock, psi.size(), column );
+    }
+
+    // observers for the column'th wavefunction of run(vector).  Only the
+    // first column's observers get to modify the operator, since it is
+    // shared by all of them.  In the interaction picture the operator is
+    // only the coupling -i E(t) D, so scaling it (an operator mask) would
+    // do nothing without a field, and more the stronger it is: those are
+    // turned down.  So are they with lanczos and chebyshev, which need the
+    // operator hermitian, and a mask makes it not.
+    void register_observable( std::unique_ptr<Observable>&& O,
+                              size_t column = 0 )
+    {
+        typedef PropagationParameters::method method;
+        if ( O != nullptr && O->modifies_operator() &&
+             parameters.propagator == method::interaction )
+            throw std::invalid_argument(
+                O->name() + ": can't modify the operator in the interaction "
+                            "picture (mask the wavefunction instead, "
+                            "absorber_every > 0)" );
+        if ( O != nullptr && O->modifies_operator() &&
+             ( parameters.propagator == method::chebyshev ||
+               ( parameters.krylov_lanczos &&
+                 parameters.propagator != method::crank_nicolson ) ) )
+            throw std::invalid_argument(
+                O->name() + ": can't modify the operator with lanczos or "
+                            "chebyshev, which need it hermitian (mask the "
+                            "wavefunction instead, absorber_every > 0)" );
+        if ( observables.size() <= column ) observables.resize( column + 1 );
+        if ( O != nullptr ) observables[column].emplace_back( std::move( O ) );
     }
 
     std::string observables_names()
     {
         using namespace std;
         stringstream ss;
-        cout << observables.size() << std::endl;
-        for ( auto& o : observables ) ss << o->name() << ", ";
-        cout << observables.size() << std::endl;
+        for ( auto& o : observables[0] ) ss << o->name() << ", ";
         return ss.str();
     }
 
-    void run( petsc::Vector psi ) { ts.solve( psi ); }
+    // solve the crank nicolson steps with a BlockTridiagonal instead of the
+    // default (diagonally preconditioned) iterative solver.  D is the matrix
+    // Dipole was made from.
+    void use_direct_solver( const petsc::Matrix& D,
+                            const std::vector<BasisID>& prototype )
+    {
+        direct.reset( new BlockTridiagonal( D, prototype, H0, Dipole ) );
+        KSP ksp;
+        TSGetKSP( ts.ts_, &ksp );
+        direct->precondition( ksp, op );
+        // with a lagged factorization the direct solve is only a
+        // preconditioner, refined to the ksp tolerance:
+        if ( parameters.lag_tolerance > 0 && parameters.lag_correct )
+            KSPSetType( ksp, KSPRICHARDSON );
+    }
+
+    // the field is zero from t on (see LaserParameters::field_end), so the
+    // rest of the propagation can be done exactly (see FieldFreeStepper).
+    void set_field_end( double t ) { field_end = t; }
+
+    void run( petsc::Vector psi ) { run( std::vector<petsc::Vector>{psi} ); }
+
+    // propagate a block of wavefunctions together: every application of the
+    // dipole operator is shared by all of them (see
+    // DipoleOperator::apply_block).
+    void run( std::vector<petsc::Vector> psi )
+    {
+        samples = 0;
+        sampled = -std::numeric_limits<double>::infinity();
+        lagged = false;
+        start_time = parameters.ti;
+        start_step = 0;
+        if ( parameters.restart ) restore( psi );
+        switch ( parameters.propagator ) {
+            case ( PropagationParameters::method::crank_nicolson ): {
+                if ( psi.size() != 1 )
+                    throw std::invalid_argument(
+                        "crank_nicolson can only propagate one wavefunction "
+                        "at a time, use krylov or interaction" );
+                auto t = start_time;
+                auto step = start_step;
+                if ( start_time < std::min( field_end, parameters.tf ) ) {
+                    if ( field_end < parameters.tf )
+                        TSSetMaxTime( ts.ts_, field_end );
+                    TSSetTime( ts.ts_, start_time );
+                    TSSetStepNumber( ts.ts_, start_step );
+                    ts.solve( psi[0] );
+                    t = ts.time();
+                    step = ts.step();
+                }
+                if ( field_end < parameters.tf )
+                    run_field_free( psi, t, step );
+                break;
+            }
+            case ( PropagationParameters::method::krylov ):
+                run_krylov( psi );
+                break;
+            case ( PropagationParameters::method::interaction ):
+                run_interaction( psi );
+                break;
+            case ( PropagationParameters::method::magnus4 ):
+                run_magnus( psi, 4 );
+                break;
+            case ( PropagationParameters::method::magnus6 ):
+                run_magnus( psi, 6 );
+                break;
+            case ( PropagationParameters::method::chebyshev ):
+                run_chebyshev( psi );
+                break;
+        }
+        report();
+        if ( active ) active->reset();
+    }
+
+    // psi(t + dt) = exp(-i H(t + dt/2) dt) psi(t), which is second order
+    // like crank nicolson, but needs no solves.
+    void run_krylov( std::vector<petsc::Vector>& psi )
+    {
+        KrylovExponential expo( psi.front(), parameters.krylov_dimension,
+                                parameters.krylov_tolerance,
+                                parameters.krylov_lanczos );
+        ExponentialStepper<> clock( expo, op, psi, start_time, start_step );
+        sample( clock, psi );
+        run_to( clock, op, H, psi, std::min( field_end, parameters.tf ) );
+        run_field_free( psi, clock.time(), clock.step() );
+    }
+
+    // the same, in the interaction picture of H0 (see InteractionStepper):
+    // the krylov space only has to resolve -i E(t) D.
+    void run_interaction( std::vector<petsc::Vector>& psi )
+    {
+        HamiltonianOperator coupling( Dipole, H0, true );
+        auto C = coupling.as_matrix();
+        KrylovExponential expo( psi.front(), parameters.krylov_dimension,
+                                parameters.krylov_tolerance,
+                                parameters.krylov_lanczos );
+        InteractionStepper clock( expo, coupling, H0, psi, start_time,
+                                  start_step );
+        sample( clock, psi );
+        run_to( clock, coupling, C, psi, std::min( field_end, parameters.tf ) );
+        run_field_free( psi, clock.time(), clock.step() );
+    }
+
+    // the same as krylov, but by chebyshev expansions, which are cheaper
+    // for long steps (with the field weak or slow, see run_adaptive_steps
+    // and macro_steps).
+    void run_chebyshev( std::vector<petsc::Vector>& psi )
+    {
+        ChebyshevExponential expo( H0, Dipole, parameters.krylov_tolerance );
+        ExponentialStepper<ChebyshevExponential> clock(
+            expo, op, psi, start_time, start_step );
+        sample( clock, psi );
+        run_to( clock, op, H, psi, std::min( field_end, parameters.tf ) );
+        run_field_free( psi, clock.time(), clock.step() );
+    }
+
+    // order 4 or 6, with the field at the gauss nodes of each step (see
+    // MagnusStepper), on fixed steps.
+    void run_magnus( std::vector<petsc::Vector>& psi, unsigned order )
+    {
+        // order 6 steps backwards in time inside every step, which grows
+        // whatever decays (ecs, an operator mask) by exp(|g2| dt Im E):
+        if ( order == 6 && ( damped() || has_operator_mask() ) ) {
+            int rank;
+            MPI_Comm_rank( H0.comm(), &rank );
+            if ( !rank )
+                std::cerr << "warning: magnus6 takes a backward substep, "
+                             "which amplifies the damped (ecs or absorbed) "
+                             "components; magnus4 doesn't"
+                          << std::endl;
+        }
+        KrylovExponential expo( psi.front(), parameters.krylov_dimension,
+                                parameters.krylov_tolerance,
+                                parameters.krylov_lanczos );
+        MagnusStepper clock( expo, op, efield, order, psi, start_time,
+                             start_step );
+        sample( clock, psi );
+        run_steps( clock, op, H, psi, std::min( field_end, parameters.tf ) );
+        run_field_free( psi, clock.time(), clock.step() );
+    }
+
+    // whether any energy of H0 has an imaginary part (an ecs basis)
+    bool damped() const
+    {
+        PetscInt n;
+        VecGetLocalSize( H0.v_, &n );
+        const PetscScalar* h;
+        VecGetArrayRead( H0.v_, &h );
+        int local = 0, any;
+        for ( PetscInt i = 0; i < n; ++i )
+            if ( h[i].imag() != 0. ) local = 1;
+        VecRestoreArrayRead( H0.v_, &h );
+        MPI_Allreduce( &local, &any, 1, MPI_INT, MPI_MAX, H0.comm() );
+        return any;
+    }
+
+    bool has_operator_mask() const
+    {
+        for ( auto& o : observables.front() )
+            if ( o->modifies_operator() ) return true;
+        return false;
+    }
+
+    // from t to tf, once the field is zero.
+    void run_field_free( std::vector<petsc::Vector>& psi, double t, int step )
+    {
+        FieldFreeStepper clock( op, psi, t, step );
+        run_steps( clock, op, H, psi, parameters.tf );
+    }
+
+    // one step of dt from where clock is, with the field of A_op (and
+    // everything that depends on it) at the middle of the step.
+    template <typename S>
+    void take_step( S& clock,
+                    HamiltonianOperator& A_op,
+                    petsc::Matrix& A,
+                    std::vector<petsc::Vector>& psi,
+                    double dt )
+    {
+        A_op.set_field( efield( clock.time() + dt / 2 ) );
+        if ( active ) {
+            std::vector<Vec> v;
+            for ( auto& p : psi ) v.push_back( p.v_ );
+            active->update( v );
+        }
+        clock.select( 0 );
+        for ( auto& o : observables[0] ) o->modify( A, psi[0], psi[0], clock );
+        clock.advance( psi, dt );
+    }
+
+    // step a clock to end in steps macro_steps dt long, on the ti + n dt
+    // grid (except for the last one, which stops at tf).
+    template <typename S>
+    void run_steps( S& clock,
+                    HamiltonianOperator& A_op,
+                    petsc::Matrix& A,
+                    std::vector<petsc::Vector>& psi,
+                    double end )
+    {
+        const auto eps = 1e-10 * parameters.dt;
+        while ( end - clock.time() > eps ) {
+            auto next = parameters.ti +
+                        ( std::floor( ( clock.time() - parameters.ti + eps ) /
+                                      parameters.dt ) +
+                          parameters.macro_steps ) *
+                            parameters.dt;
+            take_step( clock, A_op, A, psi,
+                       std::min( next, parameters.tf ) - clock.time() );
+            after_step( clock, psi );
+            sample( clock, psi );
+        }
+    }
+
+    // the same, but with steps as long as the local error allows, if there
+    // is a tolerance (for the clocks that can be reset, see
+    // run_adaptive_steps).
+    template <typename S>
+    void run_to( S& clock,
+                 HamiltonianOperator& A_op,
+                 petsc::Matrix& A,
+                 std::vector<petsc::Vector>& psi,
+                 double end )
+    {
+        if ( parameters.tolerance > 0 )
+            run_adaptive_steps( clock, A_op, A, psi, end );
+        else
+            run_steps( clock, A_op, A, psi, end );
+    }
+
+    // Step doubling: every step of dt is also taken as two of dt/2.  For a
+    // second order method the local error is C dt^3, so the two differ by
+    // 3/4 of the error of the long step, which is the one kept (the clock
+    // interpolates over it).  If that error, relative to |psi|, is over
+    // tolerance, the step is taken again from the start, shorter; either
+    // way the next one is as long as the error allows.  Each step costs
+    // three, so this only pays where the steps get much longer than dt.
+    template <typename S>
+    void run_adaptive_steps( S& clock,
+                             HamiltonianOperator& A_op,
+                             petsc::Matrix& A,
+                             std::vector<petsc::Vector>& psi,
+                             double end )
+    {
+        const auto eps = 1e-10 * parameters.dt;
+        const auto K = psi.size();
+        // the start of the step, and the two half steps from it:
+        while ( error_work.size() < 2 * K )
+            error_work.push_back( psi.front().duplicate() );
+        auto proposed = parameters.dt;
+        while ( end - clock.time() > eps ) {
+            const auto t = clock.time();
+            const auto step = clock.step();
+            for ( auto k = 0u; k < K; ++k )
+                VecCopy( psi[k].v_, error_work[k].v_ );
+            while ( true ) {
+                const auto dt = std::min( proposed, end - t );
+                take_step( clock, A_op, A, psi, dt / 2 );
+                take_step( clock, A_op, A, psi, dt / 2 );
+                for ( auto k = 0u; k < K; ++k ) {
+                    VecCopy( psi[k].v_, error_work[K + k].v_ );
+                    VecCopy( error_work[k].v_, psi[k].v_ );
+                }
+                clock.reset( t, step );
+                take_step( clock, A_op, A, psi, dt );
+
+                double error = 0;
+                for ( auto k = 0u; k < K; ++k ) {
+                    auto& halves = error_work[K + k];
+                    PetscReal d, n;
+                    VecAXPY( halves.v_, -1., psi[k].v_ );
+                    VecNorm( halves.v_, NORM_2, &d );
+                    VecNorm( psi[k].v_, NORM_2, &n );
+                    if ( n > 0 ) error = std::max( error, 4. / 3. * d / n );
+                }
+                auto factor = error > 0
+                                  ? 0.9 * std::cbrt( parameters.tolerance /
+                                                     error )
+                                  : 2.;
+                proposed = dt * std::min( 2., std::max( 0.2, factor ) );
+                if ( parameters.dt_max > 0 )
+                    proposed = std::min( proposed, parameters.dt_max );
+                proposed = std::max( proposed, parameters.dt_min );
+                if ( error <= parameters.tolerance ||
+                     dt <= parameters.dt_min + eps )
+                    break;
+                // rejected:
+                clock.reset( t, step );
+                for ( auto k = 0u; k < K; ++k )
+                    VecCopy( error_work[k].v_, psi[k].v_ );
+            }
+            after_step( clock, psi );
+            sample( clock, psi );
+        }
+    }
+
+    // whether the crank nicolson jacobian at field e, for a step of dt, can
+    // be the last one built: while the field stays within lag_tolerance of
+    // it (and dt is the same, the shift petsc adds depends on it).  With
+    // lag_correct, only the preconditioner (or factorization) is kept, and
+    // the operator is always the exact one.
+    bool lagging( double e, double dt )
+    {
+        if ( parameters.lag_tolerance > 0 && lagged &&
+             std::abs( e - lagged_field ) < parameters.lag_tolerance &&
+             dt == lagged_dt )
+            return true;
+        lagged = true;
+        lagged_field = e;
+        lagged_dt = dt;
+        return false;
+    }
+
+    // let the observers change psi (each column with its own) once a step
+    // is taken
+    void after_step( Stepper& clock, std::vector<petsc::Vector>& psi )
+    {
+        for ( auto k = 0u; k < psi.size() && k < observables.size(); ++k ) {
+            clock.select( k );
+            for ( auto& o : observables[k] ) o->after_step( psi[k], clock );
+        }
+        clock.select( 0 );
+    }
+
+    // the same for crank nicolson, on the vector petsc is stepping
+    static PetscErrorCode ts_after_step( TS t )
+    {
+        PetscContainer c;
+        PetscObjectQuery( reinterpret_cast<PetscObject>( t ), "Propagator",
+                          reinterpret_cast<PetscObject*>( &c ) );
+        Propagator* self;
+        PetscContainerGetPointer( c, reinterpret_cast<void**>( &self ) );
+        if ( self->observables.empty() ) return 0;
+        Vec u;
+        TSGetSolution( t, &u );
+        // the wrapper's destroy only gives this reference back:
+        PetscObjectReference( reinterpret_cast<PetscObject>( u ) );
+        petsc::Vector U( u );
+        TSStepper clock( self->ts );
+        for ( auto& o : self->observables[0] ) o->after_step( U, clock );
+        return 0;
+    }
 
     petsc::Vector get_operator_vector() { return H.get_right_vector(); }
 
-    petsc::Matrix& Dipole;
-    petsc::Matrix H;
+    const DipoleOperator& Dipole;
     petsc::Vector& H0;
-    std::vector<std::unique_ptr<Observable>> observables;
+    const PropagationParameters parameters;
+    const std::function<double(double)> efield;
+    double field_end{std::numeric_limits<double>::infinity()};
+    HamiltonianOperator op;
+    petsc::Matrix H;
+    // one list per column
+    std::vector<std::vector<std::unique_ptr<Observable>>> observables;
     petsc::TimeStepper ts;
+    // the next point of the sample grid, and the last time sampled
+    int samples{0};
+    double sampled{-std::numeric_limits<double>::infinity()};
+    std::vector<petsc::Vector> error_work;
+    std::unique_ptr<BlockTridiagonal> direct;
+    std::unique_ptr<ActiveSpace> active;
+    // the first column's probabilities, drawn on the propagator's comm
+    std::experimental::optional<petsc::Draw> draw;
+    // the field and step the jacobian was last built for
+    bool lagged{false};
+    double lagged_field{0};
+    double lagged_dt{0};
+    // where run starts: ti, or the checkpoint it restarts from
+    double start_time{0};
+    int start_step{0};
+    unsigned checkpoints{0};
+    // the sums of the last sample, and what to print once they are in
+    struct line {
+        size_t column;
+        int step;
+        double t;
+        size_t norm;
+        PetscInt active_states;
+    };
+    Reductions reductions;
+    std::vector<line> reported;
 };
 }
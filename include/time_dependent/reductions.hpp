@@ -0,0 +1,136 @@
+#pragma once
+
+#include <petsc_cpp/Petsc.hpp>
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Erwin
+{
+
+/*
+ * The sums over every rank that the observers need at a sample (norms,
+ * inner products, masked norms), done together:
+ *
+ * - add them (norm, masked, or a local sum of the observer's own) and
+ *   keep the handle,
+ * - sweep, while the vectors are still there: every term is summed over the
+ *   local rows in one pass, a block of rows at a time for all the terms,
+ * - start: one (non-blocking) allreduce for all of them, which can go on
+ *   while the next step is taken,
+ * - finish, and read the results by handle.
+ */
+struct Reductions {
+    Reductions() = default;
+    Reductions( const Reductions& ) = delete;
+    Reductions& operator=( const Reductions& ) = delete;
+    ~Reductions() { finish(); }
+
+    // sum_i |x_i|^2
+    size_t norm( Vec x ) { return add( kind::norm, x, PETSC_NULL ); }
+    // sum_i Re(w_i) |x_i|^2
+    size_t masked( Vec x, Vec w ) { return add( kind::masked, x, w ); }
+    // anything else, summed over the local rows already
+    size_t sum( PetscScalar partial )
+    {
+        auto h = add( kind::given, PETSC_NULL, PETSC_NULL );
+        local[h] = partial;
+        return h;
+    }
+
+    // the local sums of everything added since the last sweep
+    void sweep()
+    {
+        const auto first = swept;
+        swept = terms.size();
+        PetscInt n = 0;
+        std::vector<const PetscScalar*> x( swept - first, nullptr ),
+            y( swept - first, nullptr );
+        for ( auto k = first; k < swept; ++k ) {
+            if ( terms[k].x ) {
+                VecGetLocalSize( terms[k].x, &n );
+                VecGetArrayRead( terms[k].x, &x[k - first] );
+            }
+            if ( terms[k].y ) VecGetArrayRead( terms[k].y, &y[k - first] );
+        }
+        const PetscInt block = 1024;
+        for ( PetscInt start = 0; start < n; start += block ) {
+            const auto end = std::min( n, start + block );
+            for ( auto k = first; k < swept; ++k ) {
+                const auto a = x[k - first];
+                const auto b = y[k - first];
+                PetscScalar s = 0;
+                switch ( terms[k].type ) {
+                    case ( kind::norm ):
+                        for ( auto i = start; i < end; ++i )
+                            s += std::norm( a[i] );
+                        break;
+                    case ( kind::masked ):
+                        for ( auto i = start; i < end; ++i )
+                            s += b[i].real() * std::norm( a[i] );
+                        break;
+                    case ( kind::given ):
+                        break;
+                }
+                local[k] += s;
+            }
+        }
+        for ( auto k = first; k < swept; ++k ) {
+            if ( terms[k].x ) VecRestoreArrayRead( terms[k].x, &x[k - first] );
+            if ( terms[k].y ) VecRestoreArrayRead( terms[k].y, &y[k - first] );
+        }
+    }
+
+    // sum the local sums over comm, in the background
+    void start( MPI_Comm comm )
+    {
+        if ( swept != terms.size() )
+            throw std::logic_error( "Reductions: start before sweep" );
+        global.resize( local.size() );
+        MPI_Iallreduce( local.data(), global.data(),
+                        static_cast<int>( 2 * local.size() ), MPI_DOUBLE,
+                        MPI_SUM, comm, &request );
+    }
+
+    bool pending() const { return request != MPI_REQUEST_NULL; }
+
+    void finish()
+    {
+        if ( request != MPI_REQUEST_NULL )
+            MPI_Wait( &request, MPI_STATUS_IGNORE );
+    }
+
+    PetscScalar operator[]( size_t handle ) const { return global[handle]; }
+
+    // forget everything, for the next sample
+    void clear()
+    {
+        finish();
+        terms.clear();
+        local.clear();
+        swept = 0;
+    }
+
+  private:
+    enum class kind { norm, masked, given };
+    struct term {
+        kind type;
+        Vec x;
+        Vec y;
+    };
+
+    size_t add( kind type, Vec x, Vec y )
+    {
+        terms.push_back( {type, x, y} );
+        local.push_back( 0. );
+        return terms.size() - 1;
+    }
+
+    std::vector<term> terms;
+    size_t swept{0};
+    std::vector<PetscScalar> local;
+    std::vector<PetscScalar> global;
+    MPI_Request request{MPI_REQUEST_NULL};
+};
+}
@@ -2,9 +2,11 @@
 
 #include <utilities/data_structures.hpp>
 #include <utilities/io.hpp>
+#include <utilities/compressed_io.hpp>
 #include <parameters/basis.hpp>
 #include <tuple>
 #include <vector>
+#include <memory>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <petsc_cpp/Petsc.hpp>
 
@@ -14,14 +16,43 @@ namespace Erwin
 using namespace std;
 using namespace petsc;
 
+// decode vector i of a compressed basis file, widened to Wide if the file is
+// single precision.
+template <typename Wide, typename Narrow>
+vector<Wide>
+read_compressed( const io::CompressedVectorFile& file, size_t i, bool single )
+{
+    if ( !single ) return file.read<Wide>( i );
+    auto raw = file.read<Narrow>( i );
+    return vector<Wide>( raw.begin(), raw.end() );
+}
+
+// Compressed bases are decoded one (n, l) vector at a time.  The vectors
+// handed out then point into a buffer that the next call overwrites.
 template <typename Scalar>
 struct BasisLoader;
 template <>
 struct BasisLoader<complex<double>> {
-    BasisLoader( BasisParameters basis_ ) : basis( basis_ ) {}
+    BasisLoader( BasisParameters basis_ ) : basis( basis_ )
+    {
+        if ( basis.single_precision && !basis.compressed )
+            throw invalid_argument( "BasisLoader maps the basis files "
+                                    "directly, use BlockBasisLoader for single "
+                                    "precision bases" );
+    }
 
     const Vector left( size_t n, size_t l )
     {
+        if ( basis.compressed ) {
+            if ( !left_compressed || left_l != l ) {
+                left_l = l;
+                left_compressed.reset( new io::CompressedVectorFile(
+                    basis.compressed_filename( basis.l_filename_left( l ) ) ) );
+            }
+            left_buffer = read_compressed<complex<double>, complex<float>>(
+                *left_compressed, n - l - 1, basis.single_precision );
+            return Vector( left_buffer.data(), basis.points, Vector::type::seq );
+        }
         auto& ll = left_l;
         auto& file = left_file;
         if ( ll == l && file.is_open() ) {
@@ -45,6 +76,16 @@ struct BasisLoader<complex<double>> {
     }
     const Vector right( size_t n, size_t l )
     {
+        if ( basis.compressed ) {
+            if ( !right_compressed || right_l != l ) {
+                right_l = l;
+                right_compressed.reset( new io::CompressedVectorFile(
+                    basis.compressed_filename( basis.l_filename_right( l ) ) ) );
+            }
+            right_buffer = read_compressed<complex<double>, complex<float>>(
+                *right_compressed, n - l - 1, basis.single_precision );
+            return Vector( right_buffer.data(), basis.points, Vector::type::seq );
+        }
         auto& ll = right_l;
         auto& file = right_file;
         if ( ll == l && file.is_open() ) {
@@ -73,15 +114,39 @@ struct BasisLoader<complex<double>> {
     size_t left_l;
     boost::iostreams::mapped_file_source right_file;
     size_t right_l;
+    unique_ptr<io::CompressedVectorFile> left_compressed;
+    vector<complex<double>> left_buffer;
+    unique_ptr<io::CompressedVectorFile> right_compressed;
+    vector<complex<double>> right_buffer;
 };
 
 
 template <>
 struct BasisLoader<double> {
-    BasisLoader( BasisParameters basis_ ) : basis( basis_ ) {}
+    BasisLoader( BasisParameters basis_ ) : basis( basis_ )
+    {
+        if ( basis.single_precision && !basis.compressed )
+            throw invalid_argument( "BasisLoader maps the basis files "
+                                    "directly, use BlockBasisLoader for single "
+                                    "precision bases" );
+    }
 
     Vector left( size_t n, size_t l )
     {
+        if ( basis.compressed ) {
+            if ( !compressed || compressed_l != l ) {
+                compressed_l = l;
+                compressed.reset( new io::CompressedVectorFile(
+                    basis.compressed_filename( basis.l_filename( l ) ) ) );
+            }
+            auto v = read_compressed<double, float>( *compressed, n - l - 1,
+                                                     basis.single_precision );
+            auto a = Vector( basis.points, Vector::type::seq );
+            for ( auto i = 0u; i < basis.points; ++i )
+                a.set_value( static_cast<int>( i ), v[i] );
+            a.assemble();
+            return a;
+        }
         auto& ll = left_l;
         auto& file = left_file;
         if ( ll == l && file.is_open() ) {
@@ -110,6 +175,20 @@ struct BasisLoader<double> {
     }
     Vector right( size_t n, size_t l )
     {
+        if ( basis.compressed ) {
+            if ( !compressed || compressed_l != l ) {
+                compressed_l = l;
+                compressed.reset( new io::CompressedVectorFile(
+                    basis.compressed_filename( basis.l_filename( l ) ) ) );
+            }
+            auto v = read_compressed<double, float>( *compressed, n - l - 1,
+                                                     basis.single_precision );
+            auto a = Vector( basis.points, Vector::type::seq );
+            for ( auto i = 0u; i < basis.points; ++i )
+                a.set_value( static_cast<int>( i ), v[i] );
+            a.assemble();
+            return a;
+        }
         auto& ll = right_l;
         auto& file = right_file;
         if ( ll == l && file.is_open() ) {
@@ -143,5 +222,144 @@ struct BasisLoader<double> {
     size_t left_l;
     boost::iostreams::mapped_file_source right_file;
     size_t right_l;
+    // left and right are the same file for a real basis:
+    unique_ptr<io::CompressedVectorFile> compressed;
+    size_t compressed_l;
+};
+
+
+// A contiguous run of eigenvectors (n = first + l + 1 ... ) for a single l,
+// held in memory.  The vectors handed out point into the block, so they are
+// only valid while the block is alive.
+struct BasisBlock {
+    BasisBlock( size_t l_,
+                size_t first_,
+                size_t count_,
+                size_t points_,
+                vector<PetscScalar>&& left_,
+                vector<PetscScalar>&& right_ )
+        : l( l_ ), first( first_ ), count( count_ ), points( points_ ),
+          left_data( move( left_ ) ), right_data( move( right_ ) )
+    {
+    }
+
+    bool contains( size_t n ) const
+    {
+        return n >= l + 1 + first && n < l + 1 + first + count;
+    }
+
+    const Vector left( size_t n ) const
+    {
+        assert( contains( n ) );
+        return Vector( left_data.data() + points * ( n - l - 1 - first ),
+                       points, Vector::type::seq );
+    }
+    const Vector right( size_t n ) const
+    {
+        assert( contains( n ) );
+        // real bases are symmetric, so there is only one set of vectors:
+        const auto& data = right_data.empty() ? left_data : right_data;
+        return Vector( data.data() + points * ( n - l - 1 - first ), points,
+                       Vector::type::seq );
+    }
+
+    size_t bytes() const
+    {
+        return ( left_data.size() + right_data.size() ) * sizeof( PetscScalar );
+    }
+
+    size_t l;
+    size_t first;
+    size_t count;
+    size_t points;
+
+  private:
+    vector<PetscScalar> left_data;
+    vector<PetscScalar> right_data;
+};
+
+// Loads BasisBlocks with large sequential reads, instead of going through
+// the page cache like BasisLoader does.
+template <typename Scalar>
+struct BlockBasisLoader;
+
+template <>
+struct BlockBasisLoader<complex<double>> {
+    BlockBasisLoader( BasisParameters basis_ ) : basis( basis_ ) {}
+
+    // bytes one vector takes up once it is resident
+    size_t vector_bytes() const
+    {
+        return 2 * basis.points * sizeof( PetscScalar );
+    }
+
+    BasisBlock load( size_t l, size_t first, size_t count ) const
+    {
+        return BasisBlock( l, first, count, basis.points,
+                           read( basis.l_filename_left( l ), first, count ),
+                           read( basis.l_filename_right( l ), first, count ) );
+    }
+
+  private:
+    // single precision files are widened as they are read, so everything
+    // downstream still accumulates in double.
+    vector<PetscScalar>
+    read( const string& filename, size_t first, size_t count ) const
+    {
+        if ( basis.compressed ) {
+            io::CompressedVectorFile file( basis.compressed_filename( filename ) );
+            vector<PetscScalar> data;
+            data.reserve( count * basis.points );
+            for ( auto i = first; i < first + count; ++i ) {
+                auto v = read_compressed<complex<double>, complex<float>>(
+                    file, i, basis.single_precision );
+                data.insert( data.end(), v.begin(), v.end() );
+            }
+            return data;
+        }
+        if ( !basis.single_precision )
+            return io::import_vector_binary_range<complex<double>>(
+                filename, first * basis.points, count * basis.points );
+        auto raw = io::import_vector_binary_range<complex<float>>(
+            filename, first * basis.points, count * basis.points );
+        return vector<PetscScalar>( raw.begin(), raw.end() );
+    }
+
+    BasisParameters basis;
+};
+
+template <>
+struct BlockBasisLoader<double> {
+    BlockBasisLoader( BasisParameters basis_ ) : basis( basis_ ) {}
+
+    size_t vector_bytes() const { return basis.points * sizeof( PetscScalar ); }
+
+    BasisBlock load( size_t l, size_t first, size_t count ) const
+    {
+        auto filename = basis.l_filename( l );
+        vector<PetscScalar> data;
+        if ( basis.compressed ) {
+            io::CompressedVectorFile file( basis.compressed_filename( filename ) );
+            data.reserve( count * basis.points );
+            for ( auto i = first; i < first + count; ++i ) {
+                auto v = read_compressed<double, float>(
+                    file, i, basis.single_precision );
+                data.insert( data.end(), v.begin(), v.end() );
+            }
+        } else if ( basis.single_precision ) {
+            auto raw = io::import_vector_binary_range<float>(
+                filename, first * basis.points, count * basis.points );
+            data.assign( raw.begin(), raw.end() );
+        } else {
+            auto raw = io::import_vector_binary_range<double>(
+                filename, first * basis.points, count * basis.points );
+            data.assign( raw.begin(), raw.end() );
+        }
+        return BasisBlock( l, first, count, basis.points, move( data ),
+                           vector<PetscScalar>() );
+    }
+
+  private:
+    BasisParameters basis;
 };
 }
@@ -5,6 +5,10 @@
 
 #include <petsc_cpp/Petsc.hpp>
 
+#include <map>
+#include <algorithm>
+#include <experimental/optional>
+
 namespace Erwin
 {
 
@@ -73,21 +77,134 @@ Matrix make_dipole_matrix( BasisParameters bparams, std::vector<B> prototype )
                 auto rpart = inner_product( left, integrator, right );
                 auto angularpart =
                     math::cg_coefficient( prototype[i], prototype[j] );
+                m.set_value( i_, j_, rpart * angularpart );
+            }
+        }
+    }
+
+    m.assemble();
+
+    return m;
+}
+
+// Same matrix as make_dipole_matrix, but built out-of-core: the dipole
+// operator only couples l to l +/- 1, so we walk the (l, l+1) pairs in order
+// and only keep those two l-blocks resident.  memory_budget (in bytes) bounds
+// the resident basis data; if a pair doesn't fit, the blocks are split into
+// tiles along n and the l+1 block is re-read once per tile of l.
+template <typename B, typename Scalar>
+Matrix make_dipole_matrix_streamed( BasisParameters bparams,
+                                    std::vector<B> prototype,
+                                    size_t memory_budget )
+{
+    using namespace std;
+    using namespace petsc;
+    Matrix m( prototype.size() );
+    auto dipole_selection_rules = [&]( unsigned i, unsigned j ) {
+        return ( abs( static_cast<int>( prototype[i].l - prototype[j].l ) ) ==
+                     1 &&
+                 abs( prototype[i].m - prototype[j].m ) <= 1 ) ||
+               prototype[i] == prototype[j];
+    };
+    m.reserve( dipole_selection_rules );
+
+    auto ranges = m.get_ownership_rows();
+    auto rowstart = static_cast<unsigned>( ranges[0] );
+    auto rowend = static_cast<unsigned>( ranges[1] );
+    auto owned = [rowstart, rowend]( unsigned i ) {
+        return i >= rowstart && i < rowend;
+    };
 
-                if ( prototype[i].n == 2 && prototype[j].n == 2 ) {
-                    Vector::draw( {{left, right}} );
-                    cout << "n = 2: " << rpart << " * " << angularpart << " = "
-                         << rpart* angularpart << endl;
-                    rpart =
-                        inner_product( right, conjugate( integrator ), left );
-                    cout << "n = 2 *: " << rpart << " * " << angularpart
-                         << " = " << rpart* angularpart << endl;
-                    rpart =
-                        inner_product( conjugate( left ), integrator, right );
-                    cout << "n = 2 **: " << rpart << " * " << angularpart
-                         << " = " << rpart* angularpart << endl;
+    auto grid = io::import_vector_binary<Scalar>( bparams.grid_filename() );
+    // integration is r^3 dr;
+    Vector integrator( grid.size() - 1, Vector::type::seq );
+    populate_vector( integrator, [&grid]( unsigned i ) {
+        return grid[i] * ( i == 0 ? grid[i] : grid[i] - grid[i - 1] );
+    } );
+
+    // the states in each l, ordered by n:
+    std::map<unsigned, vector<unsigned>> blocks;
+    for ( auto i = 0u; i < prototype.size(); ++i ) {
+        blocks[prototype[i].l].push_back( i );
+        if ( owned( i ) )
+            m.set_value( static_cast<PetscInt>( i ), static_cast<PetscInt>( i ),
+                         0. );
+    }
+    for ( auto& b : blocks )
+        sort( b.second.begin(), b.second.end(), [&]( unsigned i, unsigned j ) {
+            return prototype[i].n < prototype[j].n;
+        } );
+
+    BlockBasisLoader<Scalar> bl( bparams );
+    // two tiles are resident at a time:
+    size_t tile_size =
+        max( size_t( 1 ), memory_budget / ( 2 * bl.vector_bytes() ) );
+
+    // the tiles of a block, as ranges in the (sorted) block:
+    auto tiles = [tile_size]( const vector<unsigned>& block ) {
+        vector<array<size_t, 2>> out;
+        for ( size_t a = 0; a < block.size(); a += tile_size )
+            out.push_back( {{a, min( block.size(), a + tile_size )}} );
+        return out;
+    };
+    auto load = [&]( unsigned l, const vector<unsigned>& block,
+                     array<size_t, 2> tile ) {
+        auto first = prototype[block[tile[0]]].n - l - 1;
+        auto last = prototype[block[tile[1] - 1]].n - l - 1;
+        return bl.load( l, first, last - first + 1 );
+    };
+    auto element = [&]( const BasisBlock& left, unsigned i,
+                        const BasisBlock& right, unsigned j ) {
+        auto rpart = inner_product( left.left( prototype[i].n ), integrator,
+                                    right.right( prototype[j].n ) );
+        return rpart * math::cg_coefficient( prototype[i], prototype[j] );
+    };
+
+    experimental::optional<BasisBlock> carried;
+    for ( auto a = blocks.begin(); a != blocks.end(); ++a ) {
+        auto b = next( a );
+        if ( b == blocks.end() || b->first != a->first + 1 ) {
+            carried = experimental::nullopt;
+            continue;
+        }
+        auto& block_a = a->second;
+        auto& block_b = b->second;
+
+        // does this rank own any of the rows this pair contributes to?
+        if ( none_of( block_a.begin(), block_a.end(), owned ) &&
+             none_of( block_b.begin(), block_b.end(), owned ) ) {
+            carried = experimental::nullopt;
+            continue;
+        }
+
+        auto tiles_a = tiles( block_a );
+        auto tiles_b = tiles( block_b );
+        for ( auto& ta : tiles_a ) {
+            // the last pair's l+1 block is this pair's l block, if it was
+            // whole:
+            BasisBlock left = ( carried && tiles_a.size() == 1 )
+                                  ? move( *carried )
+                                  : load( a->first, block_a, ta );
+            carried = experimental::nullopt;
+
+            for ( auto& tb : tiles_b ) {
+                BasisBlock right = load( b->first, block_b, tb );
+
+                for ( auto ii = ta[0]; ii < ta[1]; ++ii ) {
+                    for ( auto jj = tb[0]; jj < tb[1]; ++jj ) {
+                        auto i = block_a[ii];
+                        auto j = block_b[jj];
+                        if ( owned( i ) && dipole_selection_rules( i, j ) )
+                            m.set_value( static_cast<PetscInt>( i ),
+                                         static_cast<PetscInt>( j ),
+                                         element( left, i, right, j ) );
+                        if ( owned( j ) && dipole_selection_rules( j, i ) )
+                            m.set_value( static_cast<PetscInt>( j ),
+                                         static_cast<PetscInt>( i ),
+                                         element( right, j, left, i ) );
+                    }
                 }
-                m.set_value( i_, j_, rpart * angularpart );
+                if ( tiles_b.size() == 1 ) carried = move( right );
             }
         }
     }
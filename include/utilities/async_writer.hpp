@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Erwin
+{
+
+/*
+ * Binary output off the propagation thread.  Each file is a sequence of
+ * fixed size records, after a one line header
+ *
+ *     erwin-records 1 <record bytes> <schema>\n
+ *
+ * with schema the fields of a record in order, "name:type,...", the types
+ * f64 (a double, as the machine that wrote it stores them: native endian,
+ * the records are copied as they are) or c128 (two of them, re and im).
+ * The header is only written to a new (empty) file, so a file can be
+ * appended to by a later run.
+ *
+ * push copies the record into a single producer, single consumer ring
+ * (no locks: the propagation thread is the only producer) and returns.  A
+ * background thread moves the records into a buffer per file, and writes a
+ * buffer out once it is large, or every flush_interval, whichever is
+ * first.  flush waits until everything pushed so far is in the files
+ * (before a checkpoint reads their sizes, say).  The thread is only
+ * started by the first open, so ranks that write nothing don't have one.
+ * A write that fails (a full disk...) is reported on stderr when it
+ * happens, and push and flush throw from then on, rather than records
+ * going missing.
+ */
+struct AsyncWriter {
+    // the one every observer shares
+    static AsyncWriter& shared();
+
+    AsyncWriter();
+    AsyncWriter( const AsyncWriter& ) = delete;
+    AsyncWriter& operator=( const AsyncWriter& ) = delete;
+    ~AsyncWriter();
+
+    // a file of records of bytes each, described by schema: the handle to
+    // push to
+    size_t open( const std::string& filename,
+                 size_t bytes,
+                 const std::string& schema );
+    void push( size_t file, const void* record );
+    // the file is done with (once what was pushed to it is written)
+    void close( size_t file );
+    void flush();
+
+    static const size_t max_record = 48;
+
+  private:
+    struct slot {
+        enum class kind { record, open, close } type;
+        size_t file;
+        std::array<unsigned char, max_record> data;
+    };
+    struct output {
+        std::FILE* f;
+        size_t bytes;
+        std::vector<unsigned char> buffer;
+    };
+
+    void put( const slot& s );
+    void run();
+    void write( output& o );
+    // from the background thread: the first failure is kept for check
+    void fail( const std::string& what );
+    void check() const;
+
+    static const size_t ring_size = 4096;
+    static const size_t buffer_bytes = 1 << 20;
+    std::array<slot, ring_size> ring;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+
+    // the record size of each file, for push
+    std::vector<size_t> record_bytes;
+    // the background thread's own
+    std::vector<output> files;
+    std::atomic<size_t> flush_requested{0};
+    std::atomic<size_t> flushed{0};
+    std::atomic<bool> done{false};
+    // error is written before failed is set, and never after
+    std::string error;
+    std::atomic<bool> failed{false};
+    std::thread worker;
+};
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <utilities/io.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+
+namespace Erwin
+{
+
+namespace io
+{
+
+    /*
+     * A file of equal length vectors, each stored as its own compressed
+     * chunk so that any one of them can be decoded without touching the
+     * rest:
+     *
+     *   CompressedHeader
+     *   CompressedChunk[count]       (the index)
+     *   chunk data...
+     *
+     * Only the support [first, last) of each vector is stored (everything
+     * outside of it is zero), byte shuffled so that the exponents and high
+     * mantissa bytes sit next to each other, and deflated.
+     */
+    struct CompressedHeader {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t element_size;
+        std::uint64_t points;
+        std::uint64_t count;
+    };
+
+    struct CompressedChunk {
+        std::uint64_t offset;
+        std::uint64_t bytes;
+        std::uint64_t first;
+        std::uint64_t last;
+    };
+
+    // group byte b of every element together:
+    inline std::vector<char>
+    shuffle_bytes( const char* in, size_t n, size_t element_size )
+    {
+        std::vector<char> out( n * element_size );
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t b = 0; b < element_size; ++b )
+                out[b * n + i] = in[i * element_size + b];
+        return out;
+    }
+
+    inline void
+    unshuffle_bytes( const char* in, size_t n, size_t element_size, char* out )
+    {
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t b = 0; b < element_size; ++b )
+                out[i * element_size + b] = in[b * n + i];
+    }
+
+    inline std::vector<char> deflate( const std::vector<char>& in )
+    {
+        namespace bio = boost::iostreams;
+        std::vector<char> out;
+        {
+            bio::filtering_ostream os;
+            os.push( bio::zlib_compressor( bio::zlib::best_speed ) );
+            os.push( bio::back_inserter( out ) );
+            os.write( in.data(), static_cast<std::streamsize>( in.size() ) );
+        }
+        return out;
+    }
+
+    inline std::vector<char>
+    inflate( const std::vector<char>& in, size_t expected )
+    {
+        namespace bio = boost::iostreams;
+        std::vector<char> out( expected );
+        bio::filtering_istream is;
+        is.push( bio::zlib_decompressor() );
+        is.push( bio::array_source( in.data(), in.size() ) );
+        is.read( out.data(), static_cast<std::streamsize>( expected ) );
+        if ( static_cast<size_t>( is.gcount() ) != expected )
+            throw std::runtime_error( "compressed chunk is truncated" );
+        return out;
+    }
+
+    // compress the raw file of T's (points per vector) into filename.
+    // Entries smaller than tolerance * max|v| at either end of a vector are
+    // trimmed off.  Returns the compressed size over the raw size.
+    template <typename T>
+    double compress_vector_binary( const std::string& raw_filename,
+                                   const std::string& filename,
+                                   size_t points,
+                                   double tolerance = 0 )
+    {
+        using namespace std;
+        ifstream in( raw_filename.c_str(), ios::binary | ios::ate );
+        if ( !in.is_open() )
+            throw runtime_error( "file didn't open: " + raw_filename );
+        size_t raw_bytes = static_cast<size_t>( in.tellg() );
+        in.close();
+        assert( raw_bytes % ( sizeof( T ) * points ) == 0 );
+
+        CompressedHeader header{{'E', 'R', 'W', 'Z'},
+                                1,
+                                sizeof( T ),
+                                points,
+                                raw_bytes / ( sizeof( T ) * points )};
+        vector<CompressedChunk> index( header.count );
+
+        ofstream out( filename.c_str(), ios::binary | ios::out );
+        if ( !out.is_open() )
+            throw runtime_error( "error opening file " + filename +
+                                 " does the folder exist?" );
+        // the index is filled in once we know where everything went:
+        out.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+        out.write( reinterpret_cast<const char*>( index.data() ),
+                   static_cast<streamsize>( sizeof( CompressedChunk ) *
+                                            index.size() ) );
+        uint64_t offset = sizeof( header ) + sizeof( CompressedChunk ) *
+                                                 index.size();
+
+        for ( size_t i = 0; i < header.count; ++i ) {
+            auto v =
+                import_vector_binary_range<T>( raw_filename, i * points, points );
+            double largest = 0;
+            for ( auto& x : v )
+                largest = max( largest, static_cast<double>( std::abs( x ) ) );
+
+            size_t first = 0, last = points;
+            while ( first < last &&
+                    std::abs( v[first] ) <= tolerance * largest )
+                first++;
+            while ( last > first &&
+                    std::abs( v[last - 1] ) <= tolerance * largest )
+                last--;
+
+            auto chunk = deflate( shuffle_bytes(
+                reinterpret_cast<const char*>( v.data() + first ),
+                last - first, sizeof( T ) ) );
+            index[i] = CompressedChunk{offset, chunk.size(), first, last};
+            out.write( chunk.data(), static_cast<streamsize>( chunk.size() ) );
+            offset += chunk.size();
+        }
+
+        out.seekp( sizeof( header ) );
+        out.write( reinterpret_cast<const char*>( index.data() ),
+                   static_cast<streamsize>( sizeof( CompressedChunk ) *
+                                            index.size() ) );
+        out.close();
+
+        return static_cast<double>( offset ) / static_cast<double>( raw_bytes );
+    }
+
+    // random access to the vectors in a compressed file.
+    struct CompressedVectorFile {
+        CompressedVectorFile( const std::string& filename_ )
+            : filename( filename_ )
+        {
+            fd = open( filename.c_str(), O_RDONLY );
+            if ( fd < 0 )
+                throw std::runtime_error( "file didn't open: " + filename );
+            if ( pread( fd, &header, sizeof( header ), 0 ) !=
+                     sizeof( header ) ||
+                 std::memcmp( header.magic, "ERWZ", 4 ) != 0 ) {
+                close( fd );
+                throw std::runtime_error( "not a compressed vector file: " +
+                                          filename );
+            }
+            index.resize( header.count );
+            auto bytes = sizeof( CompressedChunk ) * index.size();
+            if ( pread( fd, index.data(), bytes, sizeof( header ) ) !=
+                 static_cast<ssize_t>( bytes ) ) {
+                close( fd );
+                throw std::runtime_error( "truncated index in " + filename );
+            }
+        }
+
+        CompressedVectorFile( const CompressedVectorFile& ) = delete;
+        CompressedVectorFile& operator=( const CompressedVectorFile& ) = delete;
+        ~CompressedVectorFile() { close( fd ); }
+
+        size_t size() const { return index.size(); }
+        size_t points() const { return header.points; }
+
+        // decode vector i, zeros outside of its support.
+        template <typename T>
+        std::vector<T> read( size_t i ) const
+        {
+            if ( sizeof( T ) != header.element_size )
+                throw std::invalid_argument(
+                    "wrong element type for compressed file " + filename );
+            if ( i >= index.size() )
+                throw std::out_of_range( "tried to read a vector out of range " +
+                                         filename + " @ " +
+                                         std::to_string( i ) );
+            const auto& chunk = index[i];
+            std::vector<char> packed( chunk.bytes );
+            if ( pread( fd, packed.data(), chunk.bytes,
+                        static_cast<off_t>( chunk.offset ) ) !=
+                 static_cast<ssize_t>( chunk.bytes ) )
+                throw std::runtime_error( "truncated chunk in " + filename );
+
+            auto n = chunk.last - chunk.first;
+            auto shuffled = inflate( packed, n * sizeof( T ) );
+            std::vector<T> v( header.points, T( 0 ) );
+            unshuffle_bytes( shuffled.data(), n, sizeof( T ),
+                             reinterpret_cast<char*>( v.data() + chunk.first ) );
+            return v;
+        }
+
+      private:
+        std::string filename;
+        int fd;
+        CompressedHeader header;
+        std::vector<CompressedChunk> index;
+    };
+}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <experimental/optional>
+
+namespace Erwin
+{
+
+/*
+ * E(t) on an even grid t0, t0 + h, ..., as a natural cubic spline, and the
+ * vector potential A(t) = -int_t0^t E, the exact integral of the spline.
+ * Outside the grid E is zero, and A keeps its value at the ends.
+ *
+ * Looking up a value is a clamped index and a horner polynomial, with no
+ * branches: the coefficients are padded with one piece on either side for
+ * the outside.  The sign changes of E are found once, when the table is
+ * built.
+ */
+struct FieldTable {
+    // the spline through E[i] = E(t0 + i h)
+    FieldTable( double t0_, double h_, const std::vector<double>& E );
+
+    // f sampled from t0 to t1, every h or a little less
+    template <typename F>
+    static FieldTable sample( F f, double t0, double t1, double h )
+    {
+        const auto n = static_cast<size_t>( std::ceil( ( t1 - t0 ) / h ) ) + 1;
+        h = n > 1 ? ( t1 - t0 ) / static_cast<double>( n - 1 ) : h;
+        std::vector<double> E( n );
+        for ( auto i = 0u; i < n; ++i ) E[i] = f( t0 + i * h );
+        return FieldTable( t0, h, E );
+    }
+
+    // E from the columns "t E(t)" of a text file, with t evenly spaced
+    static FieldTable read( const std::string& filename );
+
+    double operator()( double t ) const { return evaluate( field, t ); }
+    double vector_potential( double t ) const
+    {
+        return evaluate( potential, t );
+    }
+
+    double start() const { return t0; }
+    double end() const { return t0 + static_cast<double>( size - 1 ) * h; }
+
+    // the first zero crossing in (a, b], if there is one
+    std::experimental::optional<double> crossing( double a, double b ) const;
+    const std::vector<double>& crossings() const { return zeros; }
+
+  private:
+    template <size_t N>
+    double evaluate( const std::vector<std::array<double, N>>& c,
+                     double t ) const
+    {
+        // piece 0 is before t0, piece size after the end:
+        const auto x = std::min(
+            std::max( ( t - t0 ) / h + 1., 0. ), static_cast<double>( size ) );
+        const auto i = static_cast<size_t>( x );
+        const auto s = ( x - static_cast<double>( i ) ) * h;
+        const auto& a = c[i];
+        double v = a[N - 1];
+        for ( auto k = N - 1; k-- > 0; ) v = a[k] + s * v;
+        return v;
+    }
+
+    double t0;
+    double h;
+    size_t size;
+    // the polynomial in s = t - t_i on each piece, lowest power first
+    std::vector<std::array<double, 4>> field;
+    std::vector<std::array<double, 5>> potential;
+    std::vector<double> zeros;
+};
+}
@@ -2,6 +2,7 @@
 
 // c stdlib
 #include <unistd.h>
+#include <fcntl.h>
 
 // stl
 #include <iostream>
@@ -10,6 +11,10 @@
 #include <vector>
 #include <type_traits>
 #include <ios>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <complex>
 
 #include <petsc_cpp/Petsc.hpp>
 
@@ -87,6 +92,30 @@ namespace io
         file.close();
     }
 
+    // the size of the file in bytes (0 if there isn't one)
+    inline long file_size( const std::string& filename )
+    {
+        std::ifstream file( filename, std::ios::binary | std::ios::ate );
+        return file.good() ? static_cast<long>( file.tellg() ) : 0;
+    }
+
+    // the size of the first line, with its newline (0 if there isn't one):
+    // the header of a file of records (see AsyncWriter)
+    inline long header_size( const std::string& filename )
+    {
+        std::ifstream file( filename, std::ios::binary );
+        std::string line;
+        if ( !std::getline( file, line ) || file.eof() ) return 0;
+        return static_cast<long>( line.size() ) + 1;
+    }
+
+    // cut the file back to its first size bytes
+    inline void truncate_file( const std::string& filename, long size )
+    {
+        if ( ::truncate( filename.c_str(), static_cast<off_t>( size ) ) != 0 )
+            throw std::runtime_error( "Failed to truncate file " + filename );
+    }
+
     template <typename T, typename U>
     inline void export_vector_binary( const std::string& filename,
                                       const std::vector<T>& out,
@@ -180,6 +209,88 @@ namespace io
         return vec;
     }
 
+    // read count T's starting at element offset with large sequential reads.
+    // The pages are dropped from the page cache afterwards, so streaming a file
+    // much larger than memory doesn't evict everything else.
+    template <typename T>
+    std::vector<T> import_vector_binary_range( const std::string& filename,
+                                               const size_t offset,
+                                               const size_t count,
+                                               size_t chunk_size = 64 << 20 )
+    {
+#ifdef DEBUG
+        static_assert( std::is_trivially_copyable<T>(),
+                       "NO NO NO - T MUST BE TRIVIALLY COPYABLE!" );
+#endif
+        int fd = open( filename.c_str(), O_RDONLY );
+        if ( fd < 0 ) throw std::runtime_error( "file didn't open: " + filename );
+
+        const off_t begin = static_cast<off_t>( offset * sizeof( T ) );
+        const size_t bytes = count * sizeof( T );
+        posix_fadvise( fd, begin, static_cast<off_t>( bytes ),
+                       POSIX_FADV_SEQUENTIAL );
+
+        std::vector<T> vec( count );
+        char* out = reinterpret_cast<char*>( vec.data() );
+        size_t done = 0;
+        while ( done < bytes ) {
+            auto r = pread( fd, out + done, std::min( chunk_size, bytes - done ),
+                            begin + static_cast<off_t>( done ) );
+            if ( r <= 0 ) {
+                close( fd );
+                throw std::out_of_range( "tried to read past the end of " +
+                                         filename + " @ " +
+                                         std::to_string( begin + done ) );
+            }
+            done += static_cast<size_t>( r );
+        }
+        posix_fadvise( fd, begin, static_cast<off_t>( bytes ),
+                       POSIX_FADV_DONTNEED );
+        close( fd );
+
+        return vec;
+    }
+
+    // rewrite a binary file of T's as T2's (usually narrower), stride T's at
+    // a time.  Returns the largest relative error |v - T(T2(v))| / |v| over
+    // the strides, as a measure of what was lost.
+    template <typename T, typename T2>
+    double narrow_vector_binary( const std::string& filename, size_t stride )
+    {
+        std::ifstream in( filename.c_str(), std::ios::binary | std::ios::ate );
+        if ( !in.is_open() )
+            throw std::runtime_error( "file didn't open: " + filename );
+        size_t count = static_cast<size_t>( in.tellg() ) / sizeof( T );
+        in.close();
+
+        std::string tmp = filename + ".narrow";
+        std::ofstream out( tmp.c_str(), std::ios::binary | std::ios::out );
+        if ( !out.is_open() )
+            throw std::runtime_error( "error opening file " + tmp +
+                                      " does the folder exist?" );
+
+        double worst = 0;
+        for ( size_t offset = 0; offset < count; offset += stride ) {
+            auto n = std::min( stride, count - offset );
+            auto v = import_vector_binary_range<T>( filename, offset, n );
+            std::vector<T2> w( n );
+            double err = 0, norm = 0;
+            for ( size_t i = 0; i < n; ++i ) {
+                w[i] = static_cast<T2>( v[i] );
+                err += std::norm( v[i] - static_cast<T>( w[i] ) );
+                norm += std::norm( v[i] );
+            }
+            out.write( reinterpret_cast<const char*>( w.data() ),
+                       static_cast<std::streamsize>( sizeof( T2 ) * n ) );
+            if ( norm > 0 ) worst = std::max( worst, std::sqrt( err / norm ) );
+        }
+        out.close();
+        if ( std::rename( tmp.c_str(), filename.c_str() ) != 0 )
+            throw std::runtime_error( "failed to replace " + filename );
+
+        return worst;
+    }
+
     template <typename T>
     inline std::function<std::vector<T>()>
     import_vector_by_parts_fn( const std::string& filename,
@@ -41,5 +41,28 @@ namespace math
 
     std::vector<double>
     make_equally_spaced_grid( size_t grid_size, double rmin, double rmax );
+
+    // exp(A) for a small dense n x n (row major) matrix, by scaling and
+    // squaring a [6/6] pade approximant.
+    std::vector<std::complex<double>>
+    expm( const std::vector<std::complex<double>>& A, size_t n );
+
+    // the bessel functions J_k(alpha), k = 0, 1, ..., up to where they drop
+    // below tolerance for good (past k = alpha): the coefficients of the
+    // chebyshev expansion of exp(-i alpha x) on [-1, 1].
+    std::vector<double> chebyshev_exp_coefficients( double alpha,
+                                                    double tolerance );
+
+    // LU with partial pivoting of a dense n x n (row major) matrix, in place.
+    // Returns the row swaps: row i was swapped with row pivots[i].
+    std::vector<size_t> lu_factor( std::vector<std::complex<double>>& A,
+                                   size_t n );
+
+    // B <- A^-1 B for the n x m (row major) B, from lu_factor.
+    void lu_solve( const std::vector<std::complex<double>>& LU,
+                   const std::vector<size_t>& pivots,
+                   size_t n,
+                   std::complex<double>* B,
+                   size_t m );
 }
 }
@@ -1,23 +1,55 @@
 
 #include <parameters/absorber.hpp>
 #include <boost/program_options.hpp>
+#include <complex>
+#include <cmath>
 
 namespace Erwin
 {
 
 void MaskAbsorber::
-modify( petsc::Matrix& A, petsc::Vector& U, petsc::Vector&, petsc::TimeStepper& )
+modify( petsc::Matrix& A, petsc::Vector&, petsc::Vector&, Stepper& )
 {
-#if defined(DEBUG)
-    auto UU = U;
-    current_value = UU.norm();
-    UU *= mask;
-    current_value -= UU.norm();
-#endif
-
+    if ( every > 0 ) return;
     A.diagonal_scale(mask);
 }
 
+void MaskAbsorber::request( Reductions& R, const petsc::Vector& U, Stepper& )
+{
+    if ( every == 0 ) {
+        handle = R.masked( U.v_, weight.v_ );
+    } else {
+        handle = R.sum( absorbed );
+        absorbed = 0;
+    }
+}
+
+void MaskAbsorber::reduced( const Reductions& R )
+{
+    if ( every == 0 )
+        current_value = R[handle].real();
+    else
+        current_value += R[handle].real();
+}
+
+void MaskAbsorber::after_step( petsc::Vector& U, Stepper& ts )
+{
+    if ( every == 0 || ts.step() % static_cast<int>( every ) != 0 ) return;
+    PetscInt n;
+    VecGetLocalSize( U.v_, &n );
+    PetscScalar* u;
+    const PetscScalar* m;
+    VecGetArray( U.v_, &u );
+    VecGetArrayRead( mask.v_, &m );
+    for ( PetscInt i = 0; i < n; ++i ) {
+        const auto v = u[i] * m[i];
+        absorbed += std::norm( u[i] ) - std::norm( v );
+        u[i] = v;
+    }
+    VecRestoreArrayRead( mask.v_, &m );
+    VecRestoreArray( U.v_, &u );
+}
+
 std::string MaskAbsorber::last() const
 {
     using namespace std;
@@ -33,6 +65,7 @@ std::string AbsorberParameters::print() const
     stringstream ss;
     ss << "absorber_n_size=" << n_size << endl;
     ss << "absorber_l_size=" << l_size << endl;
+    ss << "absorber_every=" << every << endl;
     if ( atype != type::custom ) ss << "absorber_type=" << atype << endl;
     return ss.str();
 }
@@ -79,7 +112,7 @@ AbsorberParameters::get_observer( const std::vector<BasisID>& prototype,
                                   petsc::Vector v ) const
 {
     return std::unique_ptr<Observable>(
-        new MaskAbsorber( this->mask( prototype, v ) ) );
+        new MaskAbsorber( this->mask( prototype, v ), every ) );
 }
 
 std::istream& operator>>( std::istream& in, AbsorberParameters::type& z )
@@ -131,7 +164,13 @@ const AbsorberParameters make_AbsorberParameters( int argc, const char** argv )
                       AbsorberParameters::type::cos_eigth ),
                   "the type of absorber: \"cos_eigth\" and \"linear\" are the "
                   "only "
-                  "valid options" );
+                  "valid options" )
+
+                    ( "absorber_every",
+                      po::value<unsigned>()->default_value( 0 ),
+                      "mask the wavefunction every this many steps (0 "
+                      "masks the operator instead, which interaction, "
+                      "chebyshev and lanczos can't do)" );
 
     po::variables_map vm;
 
@@ -155,10 +194,12 @@ const AbsorberParameters make_AbsorberParameters( int argc, const char** argv )
 
     po::notify( vm );
 
-    return AbsorberParameters(
+    auto parameters = AbsorberParameters(
         vm["propagate_folder"].as<std::string>(),
         vm["absorber_n_size"].as<unsigned>(),
         vm["absorber_l_size"].as<unsigned>(),
         vm["absorber_type"].as<AbsorberParameters::type>() );
+    parameters.every = vm["absorber_every"].as<unsigned>();
+    return parameters;
 }
 }
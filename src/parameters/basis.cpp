@@ -26,6 +26,10 @@ string BasisParameters::print() const
     ss << "basis_lmax=" << lmax << endl;
     ss << "basis_points=" << points << endl;
     ss << "basis_charge=" << charge << endl;
+    ss << "basis_single_precision=" << single_precision << endl;
+    ss << "basis_compressed=" << compressed << endl;
+    if ( compressed )
+        ss << "basis_compress_tolerance=" << compress_tolerance << endl;
     ss << "basis_folder=" << folder << endl;
     ss << "basis_atom=" << atom << endl;
     if ( ecs_percent ) ss << "basis_ecs_percent=" << *ecs_percent << endl;
@@ -64,7 +68,13 @@ const BasisParameters make_BasisParameters( int argc, const char** argv )
                       po::value<double>()->default_value( 0 ),
                       "absorber size as percent of rmax size" )(
         "basis_ecs_alpha", po::value<double>()->default_value( math::PI / 6. ),
-        "alpha for external complex scaling" );
+        "alpha for external complex scaling" )(
+        "basis_single_precision", po::value<bool>()->default_value( false ),
+        "store the basis vectors in single precision" )(
+        "basis_compressed", po::value<bool>()->default_value( false ),
+        "store the basis vectors compressed, one chunk per vector" )(
+        "basis_compress_tolerance", po::value<double>()->default_value( 0 ),
+        "trim the ends of each vector where |v| <= tolerance * max|v|" );
 
 
     po::variables_map vm;
@@ -91,20 +101,30 @@ const BasisParameters make_BasisParameters( int argc, const char** argv )
     experimental::optional<double> rmin;
     if ( !vm["basis_rmin"].defaulted() ) rmin = vm["basis_rmin"].as<double>();
 
-    if ( vm["basis_ecs_percent"].defaulted() )
-        return BasisParameters(
-            io::absolute_path( vm["basis_folder"].as<string>() ),
-            vm["basis_rmax"].as<double>(), rmin,
-            vm["basis_points"].as<size_t>(), vm["basis_nmax"].as<unsigned>(),
-            vm["basis_lmax"].as<unsigned>(), vm["basis_charge"].as<double>(),
-            vm["basis_atom"].as<string>() );
-    else
-        return BasisParameters(
-            io::absolute_path( vm["basis_folder"].as<string>() ),
-            vm["basis_rmax"].as<double>(), rmin,
-            vm["basis_points"].as<size_t>(), vm["basis_nmax"].as<unsigned>(),
-            vm["basis_lmax"].as<unsigned>(), vm["basis_charge"].as<double>(),
-            vm["basis_atom"].as<string>(), vm["basis_ecs_percent"].as<double>(),
-            vm["basis_ecs_alpha"].as<double>() );
+    auto parameters = [&]() {
+        if ( vm["basis_ecs_percent"].defaulted() )
+            return BasisParameters(
+                io::absolute_path( vm["basis_folder"].as<string>() ),
+                vm["basis_rmax"].as<double>(), rmin,
+                vm["basis_points"].as<size_t>(),
+                vm["basis_nmax"].as<unsigned>(),
+                vm["basis_lmax"].as<unsigned>(),
+                vm["basis_charge"].as<double>(), vm["basis_atom"].as<string>() );
+        else
+            return BasisParameters(
+                io::absolute_path( vm["basis_folder"].as<string>() ),
+                vm["basis_rmax"].as<double>(), rmin,
+                vm["basis_points"].as<size_t>(),
+                vm["basis_nmax"].as<unsigned>(),
+                vm["basis_lmax"].as<unsigned>(),
+                vm["basis_charge"].as<double>(), vm["basis_atom"].as<string>(),
+                vm["basis_ecs_percent"].as<double>(),
+                vm["basis_ecs_alpha"].as<double>() );
+    }();
+    parameters.single_precision = vm["basis_single_precision"].as<bool>();
+    parameters.compressed = vm["basis_compressed"].as<bool>();
+    parameters.compress_tolerance = vm["basis_compress_tolerance"].as<double>();
+
+    return parameters;
 }
 }
@@ -1,27 +1,76 @@
 
 #include <parameters/dipole.hpp>
+#include <utilities/io.hpp>
 #include <numeric>
 
 namespace Erwin
 {
 
-void DipoleObserver::operator()( const petsc::Matrix&,
-                                 const petsc::Vector& U,
-                                 petsc::TimeStepper& ts )
+void DipoleObserver::request( Reductions& R,
+                              const petsc::Vector& U,
+                              Stepper& ts )
 {
-    // two copies of U:
-    auto U1 = U.duplicate();
-    auto U2 = U.duplicate();
+    // D U_s for every section s, in one apply_segmented:
+    while ( products.size() < products_size )
+        products.push_back( U.duplicate() );
+    std::vector<Vec> y;
+    for ( auto& p : products ) y.push_back( p.v_ );
+    Dipole.apply_segmented( U.v_, segments, y );
+
+    // <U_r|D U_s> for every pair, in one pass over the rows: each row adds
+    // to the sums of every section it is in.
+    const auto G = products_size;
+    std::vector<PetscScalar> sums( G * G, 0. );
+    PetscInt start, end;
+    VecGetOwnershipRange( U.v_, &start, &end );
+    const PetscScalar* u;
+    VecGetArrayRead( U.v_, &u );
+    std::vector<const PetscScalar*> ya( G );
+    for ( auto g = 0u; g < G; ++g ) VecGetArrayRead( y[g], &ya[g] );
+    for ( PetscInt i = start; i < end; ++i ) {
+        const auto ui = std::conj( u[i - start] );
+        for ( auto f = 0u; f < segments.size(); ++f ) {
+            const auto s = segments[f][static_cast<size_t>( i )];
+            if ( s < 0 ) continue;
+            auto row =
+                sums.data() + ( first[f] + static_cast<size_t>( s ) ) * G;
+            for ( auto g = 0u; g < G; ++g ) row[g] += ui * ya[g][i - start];
+        }
+    }
+    for ( auto g = 0u; g < G; ++g ) VecRestoreArrayRead( y[g], &ya[g] );
+    VecRestoreArrayRead( U.v_, &u );
+
+    // a section nothing is in has no D U_s:
+    auto index = [this]( const std::pair<size_t, int>& s ) {
+        auto n = DipoleOperator::segment_count( segments[s.first] );
+        return s.second < n ? first[s.first] + static_cast<size_t>( s.second )
+                            : products_size;
+    };
+    handles.clear();
+    for ( auto i = sections.cbegin(); i != sections.cend(); ++i )
+        for ( auto j = i; j != sections.cend(); ++j ) {
+            auto a = index( i->second ), b = index( j->second );
+            handles.push_back(
+                R.sum( a < G && b < G ? sums[a * G + b] : PetscScalar( 0 ) ) );
+        }
+    time = ts.time();
+}
+
+void DipoleObserver::reduced( const Reductions& R )
+{
+    auto h = handles.cbegin();
+    auto f = files.cbegin();
     for ( auto i = sections.cbegin(); i != sections.cend(); ++i ) {
-        petsc::map( U, i->second, U1 );
         for ( auto j = i; j != sections.cend(); ++j ) {
-            petsc::map( U, j->second, U2 );
-            PetscScalar ip = inner_product( U1, Dipole, U2 );
-            ofstreams[i->first][j->first] << ip;
+            PetscScalar ip = R[*h++];
+            if ( writer ) {
+                const double record[3] = {time, ip.real(), ip.imag()};
+                AsyncWriter::shared().push( *f++, record );
+            }
             if ( i == sections.cbegin() && j == i ) current_value = ip;
         }
     }
-    double t[2] = {ts.time(), ts.time()};
+    double t[2] = {time, time};
     double y[2] = {current_value.real(), current_value.imag()};
     draw.draw_point( t, y );
 }
@@ -36,6 +85,42 @@ std::string DipoleObserver::last() const
 }
 std::string DipoleObserver::name() const { return "dipole moment:"; }
 
+void DipoleObserver::save( std::ostream& out )
+{
+    AsyncWriter::shared().flush();
+    for ( auto i = sections.cbegin(); i != sections.cend(); ++i )
+        for ( auto j = i; j != sections.cend(); ++j ) {
+            out << io::file_size( filename( i->first, j->first ) ) << " ";
+        }
+    out << current_value.real() << " " << current_value.imag() << " ";
+}
+
+void DipoleObserver::restore( std::istream& in )
+{
+    AsyncWriter::shared().flush();
+    for ( auto i = sections.cbegin(); i != sections.cend(); ++i )
+        for ( auto j = i; j != sections.cend(); ++j ) {
+            long size;
+            in >> size;
+            if ( writer )
+                io::truncate_file( filename( i->first, j->first ), size );
+        }
+    double re, im;
+    in >> re >> im;
+    current_value = PetscScalar( re, im );
+}
+
+void DipoleObserver::rewind()
+{
+    if ( !writer ) return;
+    AsyncWriter::shared().flush();
+    for ( auto i = sections.cbegin(); i != sections.cend(); ++i )
+        for ( auto j = i; j != sections.cend(); ++j ) {
+            const auto name = filename( i->first, j->first );
+            io::truncate_file( name, io::header_size( name ) );
+        }
+}
+
 
 std::string DipoleParameters::print() const
 {
@@ -66,65 +151,51 @@ void DipoleParameters::write() const
 }
 
 std::unique_ptr<Observable>
-DipoleParameters::get_observer( const petsc::Matrix& Dipole,
-                                const std::vector<BasisID>& prototype ) const
+DipoleParameters::get_observer( const DipoleOperator& Dipole,
+                                const std::vector<BasisID>& prototype,
+                                MPI_Comm comm ) const
 {
     using namespace std;
-    map<string, function<PetscScalar(PetscScalar, int)>> sections;
-    sections.emplace( "all", []( PetscScalar a, int ) { return a; } );
-    std::string alphabet = "abcdefghijklmnopqrstuvwxyz";
-    std::string ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    vector<string> nlabels( n_sections.size() );
-    vector<string> elabels( e_sections.size() );
-
-    generate( nlabels.begin(), nlabels.end(), [&]() {
-        static unsigned i = 0;
-        return alphabet.substr( i++, 1 );
-    } );
-    generate( elabels.begin(), elabels.end(), [&]() {
-        static unsigned i = 0;
-        return ALPHABET.substr( i++, 1 );
-    } );
+    const string alphabet = "abcdefghijklmnopqrstuvwxyz";
+    const string ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
+    // every section is one label of one labelling of the basis:
+    vector<vector<int>> segments{vector<int>( prototype.size(), 0 )};
+    map<string, pair<size_t, int>> sections{{"all", {0, 0}}};
+    // the sections [bounds[k], bounds[k + 1]) of x(state), as a labelling:
+    auto label = [&]( const auto& bounds, const string& names, auto x ) {
+        vector<int> labels( prototype.size(), -1 );
+        for ( auto j = 0u; j < prototype.size(); ++j )
+            for ( auto k = 1u; k < bounds.size(); ++k )
+                if ( x( prototype[j] ) >= bounds[k - 1] &&
+                     x( prototype[j] ) < bounds[k] )
+                    labels[j] = static_cast<int>( k - 1 );
+        for ( auto k = 1u; k < bounds.size(); ++k )
+            sections.emplace( names.substr( k - 1, 1 ),
+                              make_pair( segments.size(),
+                                         static_cast<int>( k - 1 ) ) );
+        segments.push_back( labels );
+    };
 
     if ( !n_sections.empty() ) {
         auto n_sections_local = n_sections;
         if ( n_sections_local.front() != 1 )
-            n_sections_local.insert( n_sections_local.begin()++, 1 );
-
-        for ( auto n = 1u; n < n_sections_local.size(); n++ )
-            sections.emplace( string( nlabels[n - 1] ),
-                              [
-                                b = n_sections_local[n],
-                                a = n_sections_local[n - 1],
-                                &prototype
-                              ]( PetscScalar value, unsigned j ) {
-                return prototype[j].n >= a && prototype[j].n < b ? value : 0.;
-            } );
+            n_sections_local.insert( n_sections_local.begin(), 1 );
+        label( n_sections_local, alphabet,
+               []( const BasisID& b ) { return b.n; } );
     }
 
     if ( !e_sections.empty() ) {
-
         auto e_sections_local = e_sections;
         if ( e_sections_local.front() > prototype[0].e.real() )
-            e_sections_local.insert( e_sections_local.begin()++,
+            e_sections_local.insert( e_sections_local.begin(),
                                      prototype[0].e.real() - 1 );
-
-        for ( auto e = 1u; e < e_sections_local.size(); e++ )
-            sections.emplace( string( elabels[e - 1] ),
-                              [
-                                b = e_sections_local[e],
-                                a = e_sections_local[e - 1],
-                                &prototype
-                              ]( PetscScalar value, unsigned j ) {
-                return prototype[j].e.real() >= a && prototype[j].e.real() < b
-                           ? value
-                           : 0.;
-            } );
+        label( e_sections_local, ALPHABET,
+               []( const BasisID& b ) { return b.e.real(); } );
     }
 
     return unique_ptr<Observable>(
-        new DipoleObserver( folder, sections, Dipole ) );
+        new DipoleObserver( folder, segments, sections, Dipole, comm ) );
 }
 
 const DipoleParameters make_DipoleParameters( int argc, const char** argv )
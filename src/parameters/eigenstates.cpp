@@ -4,12 +4,13 @@
 
 namespace Erwin
 {
-void EigenstateObserver::operator()( const petsc::Matrix& A,
+void EigenstateObserver::operator()( const petsc::Matrix&,
                                      const petsc::Vector& U,
-                                     petsc::TimeStepper& ts )
+                                     Stepper& ts )
 {
     using namespace std;
     if ( ts.step() % steps == 0 && ts.step() != 0 ) {
+        op.set_field( efield( ts.time() ) );
         // static auto AA = A;
         // AA = A;
         // AA *= std::complex<double>(0,-1);
@@ -4,6 +4,11 @@
 #include <sstream>
 #include <string>
 #include <iterator>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <cmath>
+#include <utilities/math.hpp>
 
 
 namespace Erwin
@@ -22,6 +27,12 @@ string HamiltonianParameters::print() const
     stringstream ss;
     ss << "hamiltonian_nmax=" << nmax << endl;
     ss << "hamiltonian_lmax=" << lmax << endl;
+    ss << "hamiltonian_dipole_memory=" << dipole_memory << endl;
+    ss << "hamiltonian_dipole_single_precision=" << dipole_single_precision
+       << endl;
+    if ( dipole_check ) ss << "hamiltonian_dipole_check=true" << endl;
+    if ( truncate_tolerance > 0 )
+        ss << "hamiltonian_truncate_tolerance=" << truncate_tolerance << endl;
     ss << "hamiltonian_folder=" << folder << endl;
     if ( basis )
         ss << "hamiltonian_basis_config=" << basis->folder
@@ -42,6 +53,128 @@ vector<BasisID> shrink_prototype( vector<BasisID> rhs,
     return out;
 }
 
+Truncation truncate_prototype( const vector<BasisID>& prototype,
+                               const petsc::Matrix& D,
+                               double field,
+                               double frequency,
+                               double duration,
+                               double tolerance )
+{
+    const auto n = prototype.size();
+    Truncation out;
+    out.population.assign( n, 0. );
+
+    // every coupling (i, j, |D_ij|), on the first rank:
+    vector<double> local;
+    PetscInt start, end;
+    MatGetOwnershipRange( D.m_, &start, &end );
+    for ( PetscInt i = start; i < end; ++i ) {
+        PetscInt ncols;
+        const PetscInt* cols;
+        const PetscScalar* vals;
+        MatGetRow( D.m_, i, &ncols, &cols, &vals );
+        for ( PetscInt k = 0; k < ncols; ++k )
+            if ( vals[k] != 0. ) {
+                local.push_back( static_cast<double>( i ) );
+                local.push_back( static_cast<double>( cols[k] ) );
+                local.push_back( abs( vals[k] ) );
+            }
+        MatRestoreRow( D.m_, i, &ncols, &cols, &vals );
+    }
+    int rank, size;
+    MPI_Comm_rank( D.comm(), &rank );
+    MPI_Comm_size( D.comm(), &size );
+    vector<int> counts( static_cast<size_t>( size ) ), displs( counts.size() );
+    int count = static_cast<int>( local.size() );
+    MPI_Gather( &count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, D.comm() );
+    partial_sum( counts.begin(), counts.end() - 1, displs.begin() + 1 );
+    vector<double> all( rank ? 0 : static_cast<size_t>( displs.back() +
+                                                         counts.back() ) );
+    MPI_Gatherv( local.data(), count, MPI_DOUBLE, all.data(), counts.data(),
+                 displs.data(), MPI_DOUBLE, 0, D.comm() );
+
+    // the best path to every state, by dijkstra (the amplitudes are at
+    // most 1, so they only ever go down along a path):
+    if ( !rank && n > 0 ) {
+        vector<vector<pair<size_t, double>>> couplings( n );
+        for ( auto k = 0u; k < all.size(); k += 3 )
+            couplings[static_cast<size_t>( all[k] )].emplace_back(
+                static_cast<size_t>( all[k + 1] ), all[k + 2] );
+        const auto width = 2 * math::PI / duration;
+        auto amplitude = [&]( size_t i, size_t j, double d ) {
+            const auto de = prototype[j].e.real() - prototype[i].e.real();
+            const auto delta =
+                min( abs( de - frequency ), abs( de + frequency ) );
+            return min( 1., field * d / max( delta, width ) );
+        };
+        size_t ground = 0;
+        for ( auto i = 1u; i < n; ++i )
+            if ( prototype[i].e.real() < prototype[ground].e.real() )
+                ground = i;
+        vector<double> a( n, 0. );
+        vector<bool> done( n, false );
+        priority_queue<pair<double, size_t>> next;
+        a[ground] = 1;
+        next.emplace( 1., ground );
+        while ( !next.empty() ) {
+            const auto i = next.top().second;
+            next.pop();
+            if ( done[i] ) continue;
+            done[i] = true;
+            for ( auto& c : couplings[i] ) {
+                const auto aj = a[i] * amplitude( i, c.first, c.second );
+                if ( aj > a[c.first] ) {
+                    a[c.first] = aj;
+                    next.emplace( aj, c.first );
+                }
+            }
+        }
+        for ( auto i = 0u; i < n; ++i ) out.population[i] = a[i] * a[i];
+        out.population[ground] = 1;
+    }
+    MPI_Bcast( out.population.data(), static_cast<int>( n ), MPI_DOUBLE, 0,
+               D.comm() );
+
+    for ( auto i = 0u; i < n; ++i ) {
+        const auto p = out.population[i];
+        if ( p >= tolerance ) {
+            out.prototype.push_back( prototype[i] );
+            out.kept.push_back( static_cast<PetscInt>( i ) );
+        } else {
+            if ( p == 0 )
+                out.uncoupled++;
+            else
+                out.below++;
+            out.dropped += p;
+        }
+    }
+    return out;
+}
+
+petsc::Matrix restrict_dipole( const petsc::Matrix& D,
+                               const vector<PetscInt>& kept )
+{
+    PetscInt start, end;
+    MatGetOwnershipRange( D.m_, &start, &end );
+    vector<PetscInt> rows;
+    for ( auto k : kept )
+        if ( k >= start && k < end ) rows.push_back( k );
+    IS is;
+    ISCreateGeneral( D.comm(), static_cast<PetscInt>( rows.size() ),
+                     rows.data(), PETSC_COPY_VALUES, &is );
+    Mat sub;
+    MatCreateSubMatrix( D.m_, is, is, MAT_INITIAL_MATRIX, &sub );
+    ISDestroy( &is );
+    return petsc::Matrix( sub );
+}
+
+double spectral_radius( const vector<BasisID>& prototype )
+{
+    double r = 0;
+    for ( auto& a : prototype ) r = max( r, abs( a.e ) );
+    return r;
+}
+
 const HamiltonianParameters make_HamiltonianParameters( int argc,
                                                         const char** argv )
 {
@@ -69,6 +202,29 @@ const HamiltonianParameters make_HamiltonianParameters( int argc,
                       po::value<double>()->default_value( 1000. ),
                       "the maximum energy" )
 
+                        ( "hamiltonian_dipole_memory",
+                          po::value<size_t>()->default_value( 2048 ),
+                          "the basis data (in MB) the dipole build may keep "
+                          "in memory" )
+
+                        ( "hamiltonian_dipole_single_precision",
+                          po::value<bool>()->default_value( false ),
+                          "keep the dipole values in single precision while "
+                          "propagating" )
+
+                        ( "hamiltonian_dipole_check",
+                          po::value<bool>()->default_value( false ),
+                          "also build the dipole the old (in memory) way, "
+                          "and report the difference" )
+
+                        ( "hamiltonian_truncate_tolerance",
+                          po::value<double>()->default_value( 0 ),
+                          "drop the states the laser (laser_* options) "
+                          "can't populate above this, estimated from the "
+                          "dipole couplings (0 for none).  Check it on a "
+                          "small basis first, with propagate_check "
+                          "--check_truncation" )
+
                         ( "hamiltonian_folder",
                           po::value<string>()->default_value( "./" ),
                           "the folder the hamiltonian should be saved" )
@@ -99,25 +255,35 @@ const HamiltonianParameters make_HamiltonianParameters( int argc,
     po::notify( vm );
 
     // now get the BasisParameters structure:
-    if ( !vm["hamiltonian_basis_config"].empty() ) {
-        const char* fake_commands[3] = {
-            "placeholder",
-            "--basis_config",
-            vm["hamiltonian_basis_config"].as<string>().c_str()};
-        auto basis = make_BasisParameters( 3, fake_commands );
-
-        return HamiltonianParameters(
-            io::absolute_path( vm["hamiltonian_folder"].as<string>() ), basis,
-            vm["hamiltonian_nmax"].as<unsigned>(),
-            vm["hamiltonian_lmax"].as<unsigned>(),
-            vm["hamiltonian_mmax"].as<unsigned>(),
-            vm["hamiltonian_emax"].as<double>() );
-    } else
-        return HamiltonianParameters(
-            io::absolute_path( vm["hamiltonian_folder"].as<string>() ),
-            vm["hamiltonian_nmax"].as<unsigned>(),
-            vm["hamiltonian_lmax"].as<unsigned>(),
-            vm["hamiltonian_mmax"].as<unsigned>(),
-            vm["hamiltonian_emax"].as<double>() );
+    auto parameters = [&]() {
+        if ( !vm["hamiltonian_basis_config"].empty() ) {
+            const char* fake_commands[3] = {
+                "placeholder",
+                "--basis_config",
+                vm["hamiltonian_basis_config"].as<string>().c_str()};
+            auto basis = make_BasisParameters( 3, fake_commands );
+
+            return HamiltonianParameters(
+                io::absolute_path( vm["hamiltonian_folder"].as<string>() ),
+                basis, vm["hamiltonian_nmax"].as<unsigned>(),
+                vm["hamiltonian_lmax"].as<unsigned>(),
+                vm["hamiltonian_mmax"].as<unsigned>(),
+                vm["hamiltonian_emax"].as<double>() );
+        } else
+            return HamiltonianParameters(
+                io::absolute_path( vm["hamiltonian_folder"].as<string>() ),
+                vm["hamiltonian_nmax"].as<unsigned>(),
+                vm["hamiltonian_lmax"].as<unsigned>(),
+                vm["hamiltonian_mmax"].as<unsigned>(),
+                vm["hamiltonian_emax"].as<double>() );
+    }();
+    parameters.dipole_memory = vm["hamiltonian_dipole_memory"].as<size_t>();
+    parameters.dipole_single_precision =
+        vm["hamiltonian_dipole_single_precision"].as<bool>();
+    parameters.dipole_check = vm["hamiltonian_dipole_check"].as<bool>();
+    parameters.truncate_tolerance =
+        vm["hamiltonian_truncate_tolerance"].as<double>();
+
+    return parameters;
 }
 }
@@ -1,4 +1,6 @@
 #include <parameters/laser.hpp>
+#include <utilities/io.hpp>
+#include <algorithm>
 
 
 namespace Erwin
@@ -16,6 +18,11 @@ double sin_squared::operator()( double t, double frequency ) const
                : 0.0;
 }
 
+double sin_squared::end( double frequency ) const
+{
+    return cycles * 2. * math::PI / frequency;
+}
+
 std::string sin_squared::print() const
 {
     using namespace std;
@@ -45,20 +52,25 @@ std::string LaserParameters::print() const
     ss << "laser_frequency=" << frequency << endl;
     ss << "laser_cep=" << cep << endl;
     ss << "propagate_folder=" << folder << endl;
+    if ( filename ) ss << "laser_filename=" << *filename << endl;
+    ss << "laser_table_samples=" << table_samples << endl;
     ss << envelope->print();
     return ss.str();
 }
 
 void EfieldObserver::
-operator()( const petsc::Matrix&, const petsc::Vector&, petsc::TimeStepper& ts )
+operator()( const petsc::Matrix&, const petsc::Vector&, Stepper& ts )
 {
     if ( interpolate_next ) {
-        // find the time where ef(t) ~= 0:
+        // find the time where ef(t) ~= 0 (the table has them already),
+        // within the last step, where the state can be interpolated:
         double tnext = ts.time();
-        double tcurrent = ts.time() - ts.dt();
-        double t = ( 2 * ts.time() - ts.dt() ) / 2.;
-        while ( std::abs( efield( t ) ) > 1e-12 and tnext - t > 1e-16 and
-                t - tcurrent > 1e-16 ) {
+        double tcurrent = std::max( ts.time() - ts.dt(), ts.step_start() );
+        auto crossing = table ? table->crossing( tcurrent, tnext )
+                              : std::experimental::optional<double>();
+        double t = crossing ? *crossing : ( tcurrent + tnext ) / 2.;
+        while ( !crossing and std::abs( efield( t ) ) > 1e-12 and
+                tnext - t > 1e-16 and t - tcurrent > 1e-16 ) {
             // if sign(ef(t)) != sign(current_value) then we haven't gone
             // far enough.  advance half the distance to the next timestep
             if ( math::signum( efield( t ) ) ==
@@ -89,8 +101,11 @@ operator()( const petsc::Matrix&, const petsc::Vector&, petsc::TimeStepper& ts )
         interpolate_next = true;
     }
 
-    outfile << current_value;
     double t = ts.time();
+    if ( writer ) {
+        const double record[2] = {t, current_value};
+        AsyncWriter::shared().push( file, record );
+    }
     draw.draw_point( &t, &current_value );
 }
 
@@ -104,9 +119,45 @@ std::string EfieldObserver::last() const
 
 std::string EfieldObserver::name() const { return "efield"; }
 
-std::unique_ptr<Observable> LaserParameters::get_observer() const
+void EfieldObserver::save( std::ostream& out )
+{
+    AsyncWriter::shared().flush();
+    out << io::file_size( folder + "/efield.dat" ) << " " << current_value
+        << " " << next_value << " " << interpolate_next << " " << zero << " ";
+}
+
+void EfieldObserver::restore( std::istream& in )
+{
+    long size;
+    in >> size >> current_value >> next_value >> interpolate_next >> zero;
+    if ( !writer ) return;
+    AsyncWriter::shared().flush();
+    io::truncate_file( folder + "/efield.dat", size );
+}
+
+void EfieldObserver::rewind()
 {
-    return std::unique_ptr<Observable>( new EfieldObserver( folder, ef ) );
+    if ( !writer ) return;
+    AsyncWriter::shared().flush();
+    const auto name = folder + "/efield.dat";
+    io::truncate_file( name, io::header_size( name ) );
+}
+
+std::unique_ptr<Observable> LaserParameters::get_observer( MPI_Comm comm ) const
+{
+    return std::unique_ptr<Observable>(
+        new EfieldObserver( folder, ef, comm, table.get() ) );
+}
+
+double LaserParameters::peak_field( unsigned samples ) const
+{
+    double peak = 0;
+    auto start = table ? table->start() : 0.;
+    auto end = field_end();
+    for ( unsigned i = 0; i <= samples; ++i )
+        peak = std::max(
+            peak, std::abs( ef( start + ( end - start ) * i / samples ) ) );
+    return peak;
 }
 
 void LaserParameters::write() const
@@ -140,7 +191,13 @@ const LaserParameters make_LaserParameters( int argc, const char** argv )
               "in" )
 
                 ( "laser_filename", po::value<string>(),
-                  "the file the efield will be read from" )
+                  "the file the efield will be read from (columns t and "
+                  "E(t), evenly spaced in t)" )
+
+                    ( "laser_table_samples",
+                      po::value<unsigned>()->default_value( 0 ),
+                      "samples per laser cycle of the table the field is "
+                      "interpolated from (0 for the analytic field)" )
 
                     ( "laser_envelope_shape",
                       po::value<string>()->default_value( "sin_squared" ),
@@ -181,9 +238,27 @@ const LaserParameters make_LaserParameters( int argc, const char** argv )
     }
     po::notify( vm );
 
+    const auto frequency = vm["laser_frequency"].as<double>();
+    const auto cep = vm["laser_cep"].as<double>();
+    const auto samples = vm["laser_table_samples"].as<unsigned>();
+    shared_ptr<const FieldTable> table;
+    if ( !vm["laser_filename"].empty() )
+        table = make_shared<const FieldTable>(
+            FieldTable::read( vm["laser_filename"].as<string>() ) );
+    else if ( samples > 0 && ptr ) {
+        auto E = [&ptr, frequency, cep]( double t ) {
+            return ( *ptr )( t, frequency ) * sin( frequency * t + cep );
+        };
+        table = make_shared<const FieldTable>(
+            FieldTable::sample( E, 0., ptr->end( frequency ),
+                                2. * math::PI / frequency / samples ) );
+    }
 
-    return LaserParameters( vm["laser_frequency"].as<double>(),
-                            vm["laser_cep"].as<double>(),
-                            vm["propagate_folder"].as<string>(), ptr );
+    auto parameters = LaserParameters(
+        frequency, cep, vm["propagate_folder"].as<string>(), ptr, table );
+    if ( !vm["laser_filename"].empty() )
+        parameters.filename = vm["laser_filename"].as<string>();
+    parameters.table_samples = samples;
+    return parameters;
 }
 }
@@ -15,6 +15,33 @@ std::string PropagationParameters::print() const
     if ( initial_wavefunction_filename )
         ss << "propagate_wavefunction=" << *initial_wavefunction_filename
            << endl;
+    ss << "propagate_method=" << propagator << endl;
+    if ( active_threshold > 0 ) {
+        ss << "propagate_active_threshold=" << active_threshold << endl;
+        ss << "propagate_active_margin=" << active_margin << endl;
+    }
+    if ( tolerance > 0 ) {
+        ss << "propagate_tolerance=" << tolerance << endl;
+        ss << "propagate_dt_min=" << dt_min << endl;
+        ss << "propagate_dt_max=" << dt_max << endl;
+    }
+    for ( auto i : initial_states )
+        ss << "propagate_initial_states=" << i << endl;
+    ss << "propagate_checkpoint_every=" << checkpoint_every << endl;
+    ss << "propagate_restart=" << restart << endl;
+    if ( propagator == method::crank_nicolson ) {
+        ss << "propagate_direct=" << direct << endl;
+        ss << "propagate_recycle=" << recycle << endl;
+        ss << "propagate_guess=" << guess << endl;
+        ss << "propagate_lag_tolerance=" << lag_tolerance << endl;
+        ss << "propagate_lag_correct=" << lag_correct << endl;
+    }
+    if ( propagator != method::crank_nicolson ) {
+        ss << "propagate_krylov_dimension=" << krylov_dimension << endl;
+        ss << "propagate_krylov_tolerance=" << krylov_tolerance << endl;
+        ss << "propagate_krylov_lanczos=" << krylov_lanczos << endl;
+        ss << "propagate_macro_steps=" << macro_steps << endl;
+    }
     return ss.str();
 }
 
@@ -30,6 +57,73 @@ petsc::TimeStepper::times PropagationParameters::time() const
     return {ti, tf, dt};
 }
 
+petsc::Vector PropagationParameters::read_initial_wavefunction(
+    MPI_Comm comm ) const
+{
+    return petsc::binary_import_vector( comm, *initial_wavefunction_filename );
+}
+
+std::vector<petsc::Vector>
+PropagationParameters::initial_wavefunctions( const petsc::Vector& v ) const
+{
+    std::vector<petsc::Vector> psi;
+    if ( initial_wavefunction_filename ) {
+        psi.push_back( v.duplicate() );
+        auto wf = read_initial_wavefunction( v.comm() );
+        if ( wf.size() != v.size() )
+            throw std::invalid_argument(
+                "propagate_wavefunction isn't the size of the basis" );
+        VecCopy( wf.v_, psi.back().v_ );
+        return psi;
+    }
+    for ( auto i : initial_states ) {
+        psi.push_back( v.duplicate() );
+        VecSet( psi.back().v_, 0. );
+        psi.back().set_value( static_cast<int>( i ), 1. );
+        psi.back().assemble();
+    }
+    return psi;
+}
+
+std::istream& operator>>( std::istream& in, PropagationParameters::method& m )
+{
+    std::string token;
+    in >> token;
+    if ( token == "crank_nicolson" )
+        m = PropagationParameters::method::crank_nicolson;
+    else if ( token == "krylov" )
+        m = PropagationParameters::method::krylov;
+    else if ( token == "interaction" )
+        m = PropagationParameters::method::interaction;
+    else if ( token == "magnus4" )
+        m = PropagationParameters::method::magnus4;
+    else if ( token == "magnus6" )
+        m = PropagationParameters::method::magnus6;
+    else if ( token == "chebyshev" )
+        m = PropagationParameters::method::chebyshev;
+    else
+        throw boost::program_options::validation_error(
+            boost::program_options::validation_error::invalid_option_value );
+    return in;
+}
+std::ostream& operator<<( std::ostream& out,
+                          const PropagationParameters::method& m )
+{
+    if ( m == PropagationParameters::method::crank_nicolson )
+        out << "crank_nicolson";
+    else if ( m == PropagationParameters::method::krylov )
+        out << "krylov";
+    else if ( m == PropagationParameters::method::interaction )
+        out << "interaction";
+    else if ( m == PropagationParameters::method::magnus4 )
+        out << "magnus4";
+    else if ( m == PropagationParameters::method::magnus6 )
+        out << "magnus6";
+    else if ( m == PropagationParameters::method::chebyshev )
+        out << "chebyshev";
+    return out;
+}
+
 const PropagationParameters make_PropagationParameters( int argc,
                                                         const char** argv )
 {
@@ -58,7 +152,82 @@ const PropagationParameters make_PropagationParameters( int argc,
 
                     ( "propagate_folder",
                       po::value<string>()->default_value( "./" ),
-                      "Folder for all propagation information" );
+                      "Folder for all propagation information" )(
+                        "propagate_method",
+                        po::value<PropagationParameters::method>()
+                            ->default_value(
+                                PropagationParameters::method::crank_nicolson ),
+                        "how to step: \"crank_nicolson\", \"krylov\", "
+                        "\"interaction\", \"magnus4\", \"magnus6\" or "
+                        "\"chebyshev\"" )(
+                        "propagate_krylov_dimension",
+                        po::value<unsigned>()->default_value( 30 ),
+                        "the largest krylov space per step" )(
+                        "propagate_krylov_tolerance",
+                        po::value<double>()->default_value( 1e-10 ),
+                        "the error allowed per krylov (or chebyshev) "
+                        "exponential" )(
+                        "propagate_macro_steps",
+                        po::value<unsigned>()->default_value( 1 ),
+                        "fixed steps are this many propagate_dt long "
+                        "(not crank_nicolson)" )(
+                        "propagate_krylov_lanczos",
+                        po::value<bool>()->default_value( false ),
+                        "use the lanczos recurrence (hermitian H only)" )(
+                        "propagate_direct",
+                        po::value<bool>()->default_value( false ),
+                        "solve crank_nicolson steps directly, by blocks of "
+                        "l (every rank gathers the whole wavefunction and "
+                        "does the whole solve, so the basis has to fit on "
+                        "one rank)" )(
+                        "propagate_recycle",
+                        po::value<unsigned>()->default_value( 0 ),
+                        "krylov vectors carried from one crank_nicolson "
+                        "solve to the next" )(
+                        "propagate_guess",
+                        po::value<unsigned>()->default_value( 0 ),
+                        "previous solutions the initial guess is projected "
+                        "from" )(
+                        "propagate_lag_tolerance",
+                        po::value<double>()->default_value( 0 ),
+                        "reuse the crank_nicolson operator while the field "
+                        "changes by less than this (0 to rebuild it every "
+                        "time)" )(
+                        "propagate_lag_correct",
+                        po::value<bool>()->default_value( false ),
+                        "only reuse the preconditioner, with the exact "
+                        "operator" )(
+                        "propagate_initial_states",
+                        po::value<std::vector<unsigned>>()->multitoken(),
+                        "the basis states to propagate together (not "
+                        "crank_nicolson)" )(
+                        "propagate_active_threshold",
+                        po::value<double>()->default_value( 0 ),
+                        "only apply the dipole between states with "
+                        "amplitudes above this (0 for all; not with "
+                        "propagate_direct)" )(
+                        "propagate_active_margin",
+                        po::value<unsigned>()->default_value( 10 ),
+                        "states kept past the last active one, in n and l" )(
+                        "propagate_tolerance",
+                        po::value<double>()->default_value( 0 ),
+                        "the local error allowed per step, for adaptive "
+                        "steps (0 for fixed steps of propagate_dt)" )(
+                        "propagate_dt_min",
+                        po::value<double>()->default_value( 0 ),
+                        "the smallest adaptive step" )(
+                        "propagate_dt_max",
+                        po::value<double>()->default_value( 0 ),
+                        "the largest adaptive step (0 for no limit)" )(
+                        "propagate_checkpoint_every",
+                        po::value<unsigned>()->default_value( 0 ),
+                        "write a checkpoint every this many samples (0 for "
+                        "none)" )(
+                        "propagate_restart",
+                        po::value<bool>()->default_value( false ),
+                        "carry on from the last checkpoint in "
+                        "propagate_folder, if there is one (if not, start "
+                        "over, with its outputs cut back to their headers)" );
 
     po::variables_map vm;
 
@@ -82,16 +251,76 @@ const PropagationParameters make_PropagationParameters( int argc,
 
     po::notify( vm );
 
-    if ( !vm["propagate_wavefunction"].empty() )
-        return PropagationParameters( vm["propagate_ti"].as<double>(),
-                                      vm["propagate_tf"].as<double>(),
-                                      vm["propagate_dt"].as<double>(),
-                                      vm["propagate_wavefunction"].as<string>(),
-                                      vm["propagate_folder"].as<string>() );
-    else
-        return PropagationParameters( vm["propagate_ti"].as<double>(),
-                                      vm["propagate_tf"].as<double>(),
-                                      vm["propagate_dt"].as<double>(),
-                                      vm["propagate_folder"].as<string>() );
+    auto parameters = [&vm]() {
+        if ( !vm["propagate_wavefunction"].empty() )
+            return PropagationParameters(
+                vm["propagate_ti"].as<double>(),
+                vm["propagate_tf"].as<double>(),
+                vm["propagate_dt"].as<double>(),
+                vm["propagate_folder"].as<string>(),
+                vm["propagate_wavefunction"].as<string>() );
+        else
+            return PropagationParameters( vm["propagate_ti"].as<double>(),
+                                          vm["propagate_tf"].as<double>(),
+                                          vm["propagate_dt"].as<double>(),
+                                          vm["propagate_folder"].as<string>() );
+    }();
+    parameters.propagator =
+        vm["propagate_method"].as<PropagationParameters::method>();
+    parameters.krylov_dimension =
+        vm["propagate_krylov_dimension"].as<unsigned>();
+    parameters.krylov_tolerance = vm["propagate_krylov_tolerance"].as<double>();
+    parameters.krylov_lanczos = vm["propagate_krylov_lanczos"].as<bool>();
+    parameters.macro_steps = vm["propagate_macro_steps"].as<unsigned>();
+    if ( parameters.macro_steps == 0 )
+        throw invalid_argument( "propagate_macro_steps must be at least 1" );
+    parameters.direct = vm["propagate_direct"].as<bool>();
+    parameters.recycle = vm["propagate_recycle"].as<unsigned>();
+    parameters.guess = vm["propagate_guess"].as<unsigned>();
+    parameters.lag_tolerance = vm["propagate_lag_tolerance"].as<double>();
+    parameters.lag_correct = vm["propagate_lag_correct"].as<bool>();
+    // the direct solve is a single (preonly) application, with no krylov
+    // space to recycle or guess for:
+    if ( parameters.direct && ( parameters.recycle || parameters.guess ) )
+        throw invalid_argument( "propagate_direct can't be used with "
+                                "propagate_recycle or propagate_guess" );
+    parameters.active_threshold =
+        vm["propagate_active_threshold"].as<double>();
+    parameters.active_margin = vm["propagate_active_margin"].as<unsigned>();
+    // the factorization is of the whole D, so it would invert another
+    // operator than the windowed one the right hand side is made with:
+    if ( parameters.direct && parameters.active_threshold > 0 )
+        throw invalid_argument( "propagate_direct can't be used with "
+                                "propagate_active_threshold" );
+    parameters.tolerance = vm["propagate_tolerance"].as<double>();
+    parameters.dt_min = vm["propagate_dt_min"].as<double>();
+    parameters.dt_max = vm["propagate_dt_max"].as<double>();
+    parameters.checkpoint_every =
+        vm["propagate_checkpoint_every"].as<unsigned>();
+    parameters.restart = vm["propagate_restart"].as<bool>();
+    if ( parameters.tolerance > 0 &&
+         ( parameters.propagator == PropagationParameters::method::magnus4 ||
+           parameters.propagator == PropagationParameters::method::magnus6 ) )
+        throw invalid_argument(
+            "adaptive steps are only for the second order methods" );
+    if ( parameters.dt_max > 0 && parameters.dt_max < parameters.dt_min )
+        throw invalid_argument(
+            "propagate_dt_max is smaller than propagate_dt_min" );
+    if ( !vm["propagate_initial_states"].empty() )
+        parameters.initial_states =
+            vm["propagate_initial_states"].as<std::vector<unsigned>>();
+    if ( parameters.initial_states.size() > 1 &&
+         parameters.propagator ==
+             PropagationParameters::method::crank_nicolson )
+        throw invalid_argument( "crank_nicolson propagates one wavefunction "
+                                "at a time: more than one of "
+                                "propagate_initial_states needs another "
+                                "propagate_method" );
+    if ( parameters.initial_wavefunction_filename &&
+         !vm["propagate_initial_states"].empty() )
+        throw invalid_argument( "propagate_wavefunction and "
+                                "propagate_initial_states are either or" );
+
+    return parameters;
 }
 }
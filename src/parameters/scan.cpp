@@ -0,0 +1,137 @@
+#include <parameters/scan.hpp>
+#include <boost/program_options.hpp>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Erwin
+{
+
+std::string ScanParameters::print() const
+{
+    using namespace std;
+    stringstream ss;
+    ss << "scan_filename=" << filename << endl;
+    ss << "scan_groups=" << groups << endl;
+    ss << "scan_folder=" << folder << endl;
+    return ss.str();
+}
+
+void ScanParameters::write() const
+{
+    std::ofstream configfile{folder + "/ScanParameters.config"};
+    configfile << print();
+    configfile.close();
+}
+
+std::vector<std::vector<std::string>> ScanParameters::read_points() const
+{
+    using namespace std;
+    ifstream in( filename );
+    if ( !in.is_open() ) throw runtime_error( "file didn't open: " + filename );
+    vector<vector<string>> points;
+    string line;
+    while ( getline( in, line ) ) {
+        line = line.substr( 0, line.find( '#' ) );
+        stringstream ss( line );
+        vector<string> point;
+        string token;
+        while ( ss >> token ) {
+            if ( token.find( '=' ) == string::npos )
+                throw invalid_argument( "scan point option without a value: " +
+                                        token );
+            point.push_back( token );
+        }
+        if ( !point.empty() ) points.push_back( point );
+    }
+    return points;
+}
+
+std::vector<std::string>
+ScanParameters::point_arguments( int argc, const char** argv, size_t i ) const
+{
+    auto overrides = read_points().at( i );
+    overrides.push_back( "propagate_folder=" + point_folder( i ) );
+    return override_arguments( argc, argv, overrides );
+}
+
+std::vector<std::string>
+override_arguments( int argc,
+                    const char** argv,
+                    const std::vector<std::string>& overrides )
+{
+    using namespace std;
+    auto overridden = [&overrides]( const string& arg ) {
+        for ( auto& o : overrides ) {
+            auto name = "--" + o.substr( 0, o.find( '=' ) );
+            if ( arg == name || arg.find( name + "=" ) == 0 ) return true;
+        }
+        return false;
+    };
+
+    vector<string> args{argv[0]};
+    for ( int a = 1; a < argc; ++a ) {
+        string arg( argv[a] );
+        if ( overridden( arg ) ) {
+            // --name value
+            if ( arg.find( '=' ) == string::npos && a + 1 < argc &&
+                 argv[a + 1][0] != '-' )
+                a++;
+            continue;
+        }
+        args.push_back( arg );
+    }
+    for ( auto& o : overrides ) args.push_back( "--" + o );
+    return args;
+}
+
+const ScanParameters make_ScanParameters( int argc, const char** argv )
+{
+    namespace po = boost::program_options;
+    using namespace std;
+
+    string config_filename;
+    po::options_description only_command_line;
+    only_command_line.add_options()( "scan_config",
+                                     po::value<string>( &config_filename ),
+                                     "Scan config file" );
+
+    po::options_description scan( "Scan Options" );
+    scan.add_options()( "scan_filename", po::value<string>()->required(),
+                        "the scan points, one line of option=value overrides "
+                        "per point" )(
+        "scan_groups", po::value<unsigned>()->default_value( 1 ),
+        "the number of MPI groups, each propagating one point at a time" )(
+        "scan_folder", po::value<string>()->default_value( "./" ),
+        "the folder the point folders are made in" );
+
+    po::variables_map vm;
+
+    // we just want to get the config filename:
+    po::store( po::command_line_parser( argc, argv )
+                   .options( only_command_line )
+                   .allow_unregistered()
+                   .run(),
+               vm );
+    po::notify( vm );
+
+    ifstream fs( config_filename );
+    vm.clear();
+
+    po::store( po::command_line_parser( argc, argv )
+                   .options( scan )
+                   .allow_unregistered()
+                   .run(),
+               vm );
+    po::store( po::parse_config_file( fs, scan, true ), vm );
+    po::notify( vm );
+
+    if ( vm["scan_groups"].as<unsigned>() == 0 )
+        throw invalid_argument( "scan_groups must be at least 1" );
+
+    return ScanParameters( vm["scan_filename"].as<string>(),
+                           vm["scan_groups"].as<unsigned>(),
+                           vm["scan_folder"].as<string>() );
+}
+}
@@ -1,6 +1,8 @@
 #include <time_independent/Basis.hpp>
 #include <utilities/math.hpp>
 #include <parameters/basis.hpp>
+#include <utilities/compressed_io.hpp>
+#include <cstdio>
 
 int main( int argc, const char** argv )
 {
@@ -14,6 +16,27 @@ int main( int argc, const char** argv )
     if ( !pc.rank() ) cout << parameters.print();
     if ( !pc.rank() ) parameters.write();
 
+    // the largest relative error |v - double(float(v))| / |v| over the
+    // vectors of each l, when the basis is stored in single precision:
+    vector<double> report;
+    auto write_report = [&parameters]( const vector<double>& r ) {
+        ofstream out( parameters.precision_report_filename() );
+        out << "# l max_relative_error" << endl;
+        for ( auto l = 0u; l < r.size(); ++l ) {
+            out << l << " " << r[l] << endl;
+            cout << "single precision, l: " << l << " error: " << r[l] << endl;
+        }
+    };
+    // replace a raw basis file of T's with its compressed form:
+    auto compress = [&parameters]( const string& filename, auto t ) {
+        using T = decltype( t );
+        auto ratio = io::compress_vector_binary<T>(
+            filename, parameters.compressed_filename( filename ),
+            parameters.points, parameters.compress_tolerance );
+        std::remove( filename.c_str() );
+        cout << "compressed " << filename << " ratio: " << ratio << endl;
+    };
+
     if ( parameters.ecs_percent ) {
         auto grid = Erwin::math::make_ecs_grid(
             parameters.points, parameters.rmax, *( parameters.ecs_percent ),
@@ -45,11 +68,28 @@ int main( int argc, const char** argv )
 
             B.save_basis( parameters.l_filename_left( l ),
                           parameters.l_filename_right( l ) );
+            if ( parameters.single_precision && !pc.rank() )
+                report.push_back( max(
+                    io::narrow_vector_binary<complex<double>, complex<float>>(
+                        parameters.l_filename_left( l ), parameters.points ),
+                    io::narrow_vector_binary<complex<double>, complex<float>>(
+                        parameters.l_filename_right( l ),
+                        parameters.points ) ) );
+            if ( parameters.compressed && !pc.rank() ) {
+                for ( auto& f : {parameters.l_filename_left( l ),
+                                 parameters.l_filename_right( l )} ) {
+                    if ( parameters.single_precision )
+                        compress( f, complex<float>() );
+                    else
+                        compress( f, complex<double>() );
+                }
+            }
             B.add_evalues( prototype );
         }
         if ( !pc.rank() ) {
             parameters.write_grid( grid );
             parameters.write_prototype( prototype );
+            if ( parameters.single_precision ) write_report( report );
         }
     } else {
         auto grid = Erwin::math::make_equally_spaced_grid(
@@ -83,11 +123,21 @@ int main( int argc, const char** argv )
             }
 
             B.save_basis( parameters.l_filename( l ) );
+            if ( parameters.single_precision && !pc.rank() )
+                report.push_back( io::narrow_vector_binary<double, float>(
+                    parameters.l_filename( l ), parameters.points ) );
+            if ( parameters.compressed && !pc.rank() ) {
+                if ( parameters.single_precision )
+                    compress( parameters.l_filename( l ), float() );
+                else
+                    compress( parameters.l_filename( l ), double() );
+            }
             B.add_evalues( prototype );
         }
         if ( !pc.rank() ) {
             parameters.write_grid( grid );
             parameters.write_prototype( prototype );
+            if ( parameters.single_precision ) write_report( report );
         }
     }
 }
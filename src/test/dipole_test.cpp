@@ -2,10 +2,94 @@
 #include <petsc_cpp/Petsc.hpp>
 //#include <time_independent/time_independent.hpp>
 #include <parameters/hamiltonian.hpp>
+#include <parameters/laser.hpp>
 #include <time_independent/BasisLoader.hpp>
 #include <time_independent/dipole_matrix.hpp>
 #include <utilities/io.hpp>
 
+// the streamed dipole, checked against make_dipole_matrix if asked
+template <typename Scalar>
+petsc::Matrix build_dipole( const Erwin::HamiltonianParameters& parameters,
+                            const std::vector<Erwin::BasisID>& prototype )
+{
+    using namespace Erwin;
+    auto D = make_dipole_matrix_streamed<BasisID, Scalar>(
+        *( parameters.basis ), prototype, parameters.dipole_memory << 20 );
+    if ( !parameters.dipole_check ) return D;
+
+    auto reference =
+        make_dipole_matrix<BasisID, Scalar>( *( parameters.basis ), prototype );
+    PetscReal norm, difference;
+    MatNorm( reference.m_, NORM_FROBENIUS, &norm );
+    MatAXPY( reference.m_, -1., D.m_, DIFFERENT_NONZERO_PATTERN );
+    MatNorm( reference.m_, NORM_FROBENIUS, &difference );
+    if ( !D.rank() )
+        std::cout << "dipole check: |D_streamed - D| = " << difference
+                  << ", |D| = " << norm << std::endl;
+    return D;
+}
+
+
+// write the prototype, H0 and D
+void write_hamiltonian( const Erwin::HamiltonianParameters& parameters,
+                        const std::vector<Erwin::BasisID>& prototype,
+                        const petsc::Matrix& D )
+{
+    using namespace Erwin;
+    parameters.write_prototype( prototype );
+    if ( !D.rank() )
+        for ( auto& a : prototype ) std::cout << a << std::endl;
+
+    auto H = make_field_free( prototype );
+    parameters.write_field_free( H );
+
+    D.print();
+    parameters.write_dipole( D );
+}
+
+// the same, truncated first if asked (see truncate_prototype): D is built
+// for the whole prototype, the estimate needs it, and then restricted to
+// the states kept.
+template <typename Scalar>
+void build_hamiltonian( const Erwin::HamiltonianParameters& parameters,
+                        const std::vector<Erwin::BasisID>& prototype,
+                        int argc,
+                        const char** argv )
+{
+    using namespace Erwin;
+    using namespace std;
+    auto D = build_dipole<Scalar>( parameters, prototype );
+    if ( parameters.truncate_tolerance <= 0 ) {
+        write_hamiltonian( parameters, prototype, D );
+        return;
+    }
+
+    auto laser = make_LaserParameters( argc, argv );
+    const auto field = laser.peak_field();
+    auto t = truncate_prototype( prototype, D, field, laser.frequency,
+                                 laser.field_end(),
+                                 parameters.truncate_tolerance );
+
+    auto kept = restrict_dipole( D, t.kept );
+
+    PetscReal before, after;
+    MatNorm( D.m_, NORM_INFINITY, &before );
+    MatNorm( kept.m_, NORM_INFINITY, &after );
+    const auto h0_before = spectral_radius( prototype ),
+               h0_after = spectral_radius( t.prototype );
+    if ( !D.rank() )
+        cout << "truncated to " << t.prototype.size() << " of "
+             << prototype.size() << " states: " << t.uncoupled
+             << " not coupled to the lowest, " << t.below
+             << " below the tolerance (their estimates add up to "
+             << t.dropped << ")" << endl
+             << "max |E| (|H0|) " << h0_before << " -> " << h0_after
+             << ", |H0| + F |D|_inf (bounds the spectral radius of H(t)) "
+             << h0_before + field * before << " -> "
+             << h0_after + field * after << endl;
+    write_hamiltonian( parameters, t.prototype, kept );
+}
+
 
 int main( int argc, const char** argv )
 {
@@ -26,26 +110,10 @@ int main( int argc, const char** argv )
     auto old_prototype = parameters.basis->read_prototype();
     auto new_prototype =
         shrink_prototype( old_prototype, parameters.max_basis() );
-    parameters.write_prototype( new_prototype );
-    if ( !pc.rank() )
-        for ( auto& a : new_prototype ) cout << a << endl;
 
-    auto H = make_field_free( new_prototype );
-    parameters.write_field_free( H );
-
-    if ( !parameters.basis->ecs_percent ) {
-        auto D = make_dipole_matrix<BasisID, double>( *( parameters.basis ),
-                                                      new_prototype );
-
-        D.print();
-
-        parameters.write_dipole( D );
-    } else {
-        auto D = make_dipole_matrix<BasisID, complex<double>>(
-            *( parameters.basis ), new_prototype );
-
-        D.print();
-
-        parameters.write_dipole( D );
-    }
+    if ( !parameters.basis->ecs_percent )
+        build_hamiltonian<double>( parameters, new_prototype, argc, argv );
+    else
+        build_hamiltonian<complex<double>>( parameters, new_prototype, argc,
+                                            argv );
 }
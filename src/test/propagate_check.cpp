@@ -0,0 +1,241 @@
+#include <parameters/hamiltonian.hpp>
+#include <parameters/laser.hpp>
+#include <parameters/propagate.hpp>
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/propagator.hpp>
+#include <time_dependent/dipole_operator.hpp>
+#include <time_independent/dipole_matrix.hpp>
+#include <utilities/math.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+
+// Checks of the propagation against itself, on small bases:
+//
+//   check_truncation: propagate in the whole basis of hamiltonian_folder
+//       (built without hamiltonian_truncate_tolerance) and in what
+//       truncate_prototype keeps of it, with the same laser and
+//       propagation options, and compare the final populations.  Fails if
+//       any kept state's differs by more than the tolerance.
+//   check_order: the convergence order of magnus4 and magnus6 with fixed
+//       steps, on hydrogen's 1s and 2p0 in a resonant sin^2 pulse (no basis
+//       files needed).  Fails if the error doesn't fall with dt like dt^4
+//       and dt^6 (within half an order) as the steps are halved.
+
+namespace
+{
+using namespace Erwin;
+
+// a copy of the state at tf
+struct FinalState final : Observable {
+    FinalState( double tf_ ) : tf( tf_ ) {}
+    void operator()( const petsc::Matrix&, const petsc::Vector& U, Stepper& ts )
+    {
+        if ( ts.time() < tf ) return;
+        state = U.duplicate();
+        VecCopy( U.v_, state.v_ );
+    }
+    void modify( petsc::Matrix&, petsc::Vector&, petsc::Vector&, Stepper& ) {}
+    std::string last() const { return ""; }
+    std::string name() const { return "final state"; }
+
+    const double tf;
+    petsc::Vector state;
+};
+
+// all of v, on the first rank (and nothing on the others)
+std::vector<PetscScalar> gather( const petsc::Vector& v )
+{
+    VecScatter scatter;
+    Vec all;
+    VecScatterCreateToZero( v.v_, &scatter, &all );
+    VecScatterBegin( scatter, v.v_, all, INSERT_VALUES, SCATTER_FORWARD );
+    VecScatterEnd( scatter, v.v_, all, INSERT_VALUES, SCATTER_FORWARD );
+    PetscInt n;
+    VecGetLocalSize( all, &n );
+    const PetscScalar* a;
+    VecGetArrayRead( all, &a );
+    std::vector<PetscScalar> out( a, a + n );
+    VecRestoreArrayRead( all, &a );
+    VecScatterDestroy( &scatter );
+    VecDestroy( &all );
+    return out;
+}
+
+// the state at tf, from the one basis state start
+std::vector<PetscScalar> propagate( const DipoleOperator& D,
+                                    petsc::Vector& H0,
+                                    PropagationParameters parameters,
+                                    const LaserParameters& laser,
+                                    unsigned start )
+{
+    parameters.initial_states = {start};
+    Propagator p( D, H0, parameters, laser.efield() );
+    p.set_field_end( laser.field_end() );
+    auto final_state = new FinalState( parameters.tf );
+    p.register_observable( std::unique_ptr<Observable>( final_state ) );
+    p.run( parameters.initial_wavefunctions( H0 ) );
+    return gather( final_state->state );
+}
+
+int check_order()
+{
+    using namespace std;
+    // 1s and 2p0, coupled by <1s|z|2p0> = 128 sqrt(2) / 243:
+    vector<BasisID> prototype{{1, 0, 0, -0.5}, {2, 1, 0, -0.125}};
+    auto H0 = make_field_free( prototype );
+    petsc::Matrix D( prototype.size() );
+    D.reserve( []( unsigned, unsigned ) { return true; } );
+    auto rows = D.get_ownership_rows();
+    for ( auto i = rows[0]; i < rows[1]; ++i )
+        for ( int j = 0; j < 2; ++j )
+            D.set_value( i, j, i == j ? 0. : 128. * sqrt( 2. ) / 243. );
+    D.assemble();
+    MatrixDipole dipole( D );
+
+    const double frequency = 0.375, field = 0.1, T = 100;
+    const std::function<double( double )> efield = [=]( double t ) {
+        const auto s = sin( math::PI * t / T );
+        return field * s * s * sin( frequency * t );
+    };
+    auto final_state = [&]( PropagationParameters::method m, unsigned n ) {
+        PropagationParameters parameters( 0, T, T / n, "./" );
+        parameters.propagator = m;
+        // the krylov space is the whole (two state) basis, so exact:
+        parameters.krylov_tolerance = 1e-15;
+        Propagator p( dipole, H0, parameters, efield );
+        auto state = new FinalState( T );
+        p.register_observable( std::unique_ptr<Observable>( state ) );
+        p.run( parameters.initial_wavefunctions( H0 ) );
+        return gather( state->state );
+    };
+
+    typedef PropagationParameters::method method;
+    const auto reference = final_state( method::magnus6, 6400 );
+    int failed = 0;
+    for ( auto order : {4u, 6u} ) {
+        const auto m = order == 4 ? method::magnus4 : method::magnus6;
+        vector<double> errors;
+        for ( unsigned n = 100; n <= 800; n *= 2 ) {
+            auto psi = final_state( m, n );
+            double e = 0;
+            for ( auto i = 0u; i < psi.size(); ++i )
+                e = max( e, abs( psi[i] - reference[i] ) );
+            errors.push_back( e );
+        }
+        if ( D.rank() ) continue;
+        cout << "magnus" << order << ", error at 100, 200, 400, 800 steps:";
+        for ( auto e : errors ) cout << " " << e;
+        cout << endl << "  orders:";
+        double last = 0;
+        for ( auto i = 1u; i < errors.size(); ++i ) {
+            last = log2( errors[i - 1] / errors[i] );
+            cout << " " << last;
+        }
+        cout << endl;
+        const bool ok = abs( last - order ) <= 0.5;
+        cout << "  " << ( ok ? "passed" : "FAILED" ) << endl;
+        failed |= !ok;
+    }
+    MPI_Bcast( &failed, 1, MPI_INT, 0, D.comm() );
+    return failed;
+}
+
+int check_truncation( int argc, const char** argv )
+{
+    using namespace std;
+    auto laser = make_LaserParameters( argc, argv );
+    auto hamiltonian = make_HamiltonianParameters( argc, argv );
+    auto propagation = make_PropagationParameters( argc, argv );
+    const auto tolerance = hamiltonian.truncate_tolerance;
+    if ( tolerance <= 0 )
+        throw invalid_argument(
+            "check_truncation needs hamiltonian_truncate_tolerance" );
+    if ( propagation.initial_wavefunction_filename )
+        throw invalid_argument(
+            "check_truncation starts from propagate_initial_states" );
+
+    auto prototype = hamiltonian.read_prototype();
+    auto H0 = hamiltonian.read_field_free();
+    auto D = hamiltonian.read_dipole();
+    auto t = truncate_prototype( prototype, D, laser.peak_field(),
+                                 laser.frequency, laser.field_end(),
+                                 tolerance );
+    auto D_kept = restrict_dipole( D, t.kept );
+    auto H0_kept = make_field_free( t.prototype );
+
+    const auto start = propagation.initial_states.front();
+    auto position = find( t.kept.begin(), t.kept.end(),
+                          static_cast<PetscInt>( start ) );
+    if ( position == t.kept.end() )
+        throw invalid_argument( "check_truncation: the initial state isn't "
+                                "kept" );
+
+    auto whole = propagate( MatrixDipole( D ), H0, propagation, laser, start );
+    auto truncated = propagate(
+        MatrixDipole( D_kept ), H0_kept, propagation, laser,
+        static_cast<unsigned>( position - t.kept.begin() ) );
+
+    int failed = 0;
+    if ( !D.rank() ) {
+        // the populations of the kept states, and what the whole basis puts
+        // into the others:
+        double worst = 0, outside = 0;
+        size_t worst_state = 0;
+        vector<bool> kept( prototype.size(), false );
+        for ( auto i = 0u; i < t.kept.size(); ++i ) {
+            const auto k = static_cast<size_t>( t.kept[i] );
+            kept[k] = true;
+            const auto d = abs( norm( whole[k] ) - norm( truncated[i] ) );
+            if ( d > worst ) {
+                worst = d;
+                worst_state = k;
+            }
+        }
+        for ( auto k = 0u; k < prototype.size(); ++k )
+            if ( !kept[k] ) outside += norm( whole[k] );
+        cout << "kept " << t.prototype.size() << " of " << prototype.size()
+             << " states" << endl
+             << "largest population difference: " << worst << " ("
+             << prototype[worst_state] << ")" << endl
+             << "population of the dropped states: " << outside
+             << " (estimated " << t.dropped << ")" << endl;
+        failed = worst > tolerance;
+        cout << ( failed ? "FAILED" : "passed" ) << endl;
+    }
+    MPI_Bcast( &failed, 1, MPI_INT, 0, D.comm() );
+    return failed;
+}
+}
+
+int main( int argc, const char** argv )
+{
+    namespace po = boost::program_options;
+    using namespace petsc;
+    using namespace std;
+
+    PetscContext pc( argc, argv );
+
+    po::options_description checks( "Check Options" );
+    checks.add_options()( "check_truncation",
+                          po::value<bool>()->default_value( false ),
+                          "compare the whole and the truncated basis (see "
+                          "truncate_prototype)" )(
+        "check_order", po::value<bool>()->default_value( false ),
+        "measure the convergence order of magnus4 and magnus6" );
+    po::variables_map vm;
+    po::store( po::command_line_parser( argc, argv )
+                   .options( checks )
+                   .allow_unregistered()
+                   .run(),
+               vm );
+    po::notify( vm );
+
+    int failed = 0;
+    if ( vm["check_truncation"].as<bool>() )
+        failed |= check_truncation( argc, argv );
+    if ( vm["check_order"].as<bool>() ) failed |= check_order();
+    return failed;
+}
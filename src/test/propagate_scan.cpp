@@ -0,0 +1,169 @@
+#define SLEPC
+
+#include <parameters/hamiltonian.hpp>
+#include <parameters/laser.hpp>
+#include <parameters/propagate.hpp>
+#include <parameters/absorber.hpp>
+#include <parameters/scan.hpp>
+#include <petsc_cpp/Petsc.hpp>
+#include <time_dependent/propagator.hpp>
+#include <time_dependent/dipole_operator.hpp>
+#include <parameters/dipole.hpp>
+#include <sys/stat.h>
+
+// Runs propagate_test for every point of a scan (see ScanParameters).  The
+// Hamiltonian is read once, and the world is split into scan_groups groups
+// that each get their own copy of it, and take the next point from a shared
+// counter whenever they finish one.
+int main( int argc, const char** argv )
+{
+    using namespace petsc;
+    using namespace Erwin;
+
+    PetscContext pc( argc, argv );
+
+    auto scan = make_ScanParameters( argc, argv );
+    auto hamiltonian = make_HamiltonianParameters( argc, argv );
+    if ( !pc.rank() ) cout << scan.print() << hamiltonian.print();
+    if ( !pc.rank() ) scan.write();
+    auto points = scan.read_points();
+
+    int world_size, world_rank;
+    MPI_Comm_size( PETSC_COMM_WORLD, &world_size );
+    MPI_Comm_rank( PETSC_COMM_WORLD, &world_rank );
+    if ( static_cast<int>( scan.groups ) > world_size )
+        throw invalid_argument( "scan_groups is larger than the number of "
+                                "processes" );
+    MPI_Comm group;
+    int color = static_cast<int>(
+        static_cast<long>( world_rank ) * scan.groups / world_size );
+    MPI_Comm_split( PETSC_COMM_WORLD, color, world_rank, &group );
+    int group_rank;
+    MPI_Comm_rank( group, &group_rank );
+
+    auto prototype = hamiltonian.read_prototype();
+
+    // read everything once over the whole world, and hand each group a full
+    // copy laid out over its own processes:
+    auto H0 = [&]() {
+        auto H0_world = hamiltonian.read_field_free();
+        Vec all;
+        VecScatter to_all;
+        VecScatterCreateToAll( H0_world.v_, &to_all, &all );
+        VecScatterBegin( to_all, H0_world.v_, all, INSERT_VALUES,
+                         SCATTER_FORWARD );
+        VecScatterEnd( to_all, H0_world.v_, all, INSERT_VALUES,
+                       SCATTER_FORWARD );
+
+        Vec h;
+        VecCreateMPI( group, PETSC_DECIDE,
+                      static_cast<PetscInt>( prototype.size() ), &h );
+        PetscInt start, end;
+        VecGetOwnershipRange( h, &start, &end );
+        const PetscScalar* a;
+        PetscScalar* b;
+        VecGetArrayRead( all, &a );
+        VecGetArray( h, &b );
+        std::copy( a + start, a + end, b );
+        VecRestoreArray( h, &b );
+        VecRestoreArrayRead( all, &a );
+        VecScatterDestroy( &to_all );
+        VecDestroy( &all );
+        return Vector( h );
+    }();
+    auto D = [&]() {
+        auto D_world = hamiltonian.read_dipole();
+        Mat d;
+        MatCreateRedundantMatrix( D_world.m_,
+                                  static_cast<PetscInt>( scan.groups ), group,
+                                  MAT_INITIAL_MATRIX, &d );
+        return Matrix( d );
+    }();
+    // the propagation only needs the dense l-blocks of D (and D itself only
+    // for the direct solver):
+    auto D_blocks =
+        make_block_dipole( D, prototype, hamiltonian.dipole_single_precision );
+
+    // the next point to run is the value of a counter on world rank 0:
+    long* counter;
+    MPI_Win window;
+    MPI_Win_allocate( world_rank ? 0 : sizeof( long ), sizeof( long ),
+                      MPI_INFO_NULL, PETSC_COMM_WORLD, &counter, &window );
+    if ( !world_rank ) {
+        MPI_Win_lock( MPI_LOCK_EXCLUSIVE, 0, 0, window );
+        *counter = 0;
+        MPI_Win_unlock( 0, window );
+    }
+    MPI_Barrier( PETSC_COMM_WORLD );
+    auto next_point = [&]() {
+        long i = 0, one = 1;
+        if ( !group_rank ) {
+            MPI_Win_lock( MPI_LOCK_SHARED, 0, 0, window );
+            MPI_Fetch_and_op( &one, &i, MPI_LONG, 0, 0, MPI_SUM, window );
+            MPI_Win_unlock( 0, window );
+        }
+        MPI_Bcast( &i, 1, MPI_LONG, 0, group );
+        return static_cast<size_t>( i );
+    };
+
+    for ( auto i = next_point(); i < points.size(); i = next_point() ) {
+        auto args = scan.point_arguments( argc, argv, i );
+        vector<const char*> point_argv;
+        for ( auto& a : args ) point_argv.push_back( a.c_str() );
+        auto point_argc = static_cast<int>( point_argv.size() );
+
+        if ( !group_rank ) mkdir( scan.point_folder( i ).c_str(), 0755 );
+        MPI_Barrier( group );
+
+        auto laser = make_LaserParameters( point_argc, point_argv.data() );
+        auto absorber =
+            make_AbsorberParameters( point_argc, point_argv.data() );
+        auto propagation =
+            make_PropagationParameters( point_argc, point_argv.data() );
+        auto dipole = make_DipoleParameters( point_argc, point_argv.data() );
+        if ( !group_rank ) {
+            cout << "group " << color << " point " << i << ":" << endl
+                 << laser.print();
+            laser.write();
+            absorber.write();
+            propagation.write();
+            dipole.write();
+        }
+
+        Propagator p( *D_blocks, H0, propagation, laser.efield() );
+        p.set_field_end( laser.field_end() );
+        if ( propagation.direct ) p.use_direct_solver( D, prototype );
+        p.register_observable( laser.get_observer( group ) );
+        p.register_observable(
+            absorber.get_observer( prototype, p.get_operator_vector() ) );
+        p.register_observable(
+            dipole.get_observer( *D_blocks, prototype, group ) );
+        // every other initial state gets its own folder in the point's:
+        for ( auto k = 1u; k < propagation.initial_states.size(); ++k ) {
+            auto folder = scan.point_folder( i ) + "/state_" +
+                          std::to_string( propagation.initial_states[k] );
+            if ( !group_rank ) mkdir( folder.c_str(), 0755 );
+            MPI_Barrier( group );
+            auto state_args = override_arguments(
+                point_argc, point_argv.data(),
+                {"propagate_folder=" + folder} );
+            vector<const char*> state_argv;
+            for ( auto& a : state_args ) state_argv.push_back( a.c_str() );
+            auto state_argc = static_cast<int>( state_argv.size() );
+
+            p.register_observable(
+                make_AbsorberParameters( state_argc, state_argv.data() )
+                    .get_observer( prototype, p.get_operator_vector() ),
+                k );
+            p.register_observable(
+                make_DipoleParameters( state_argc, state_argv.data() )
+                    .get_observer( *D_blocks, prototype, group ),
+                k );
+        }
+
+        p.run( propagation.initial_wavefunctions( p.get_operator_vector() ) );
+    }
+
+    MPI_Win_free( &window );
+    MPI_Comm_free( &group );
+}
@@ -6,8 +6,12 @@
 #include <parameters/absorber.hpp>
 #include <petsc_cpp/Petsc.hpp>
 #include <time_dependent/propagator.hpp>
+#include <time_dependent/dipole_operator.hpp>
 #include <parameters/dipole.hpp>
 #include <parameters/eigenstates.hpp>
+#include <parameters/scan.hpp>
+#include <sys/stat.h>
+#include <limits>
 
 int main( int argc, const char** argv )
 {
@@ -41,22 +45,67 @@ int main( int argc, const char** argv )
 
     auto H0 = hamiltonian.read_field_free();
     auto D = hamiltonian.read_dipole();
+    // the propagator and the observers only ever need D x, so they can use
+    // the dense l-blocks:
+    auto D_blocks =
+        make_block_dipole( D, prototype, hamiltonian.dipole_single_precision );
+    if ( hamiltonian.dipole_single_precision ) {
+        // how much does single precision cost us?  an estimate, the worst
+        // of all ones and a random vector, so every column counts:
+        auto x = D.get_right_vector();
+        x.set_all( 1. );
+        x.assemble();
+        auto err = relative_difference( *D_blocks, MatrixDipole( D ), x );
+        VecSetRandom( x.v_, PETSC_NULL );
+        err = std::max(
+            err, relative_difference( *D_blocks, MatrixDipole( D ), x ) );
+        // and a bound: every value is rounded once (the sums are done in
+        // double), by at most half a float ulp of itself, so
+        // |D_single - D|_inf <= eps/2 |D|_inf:
+        const auto bound = std::numeric_limits<float>::epsilon() / 2 *
+                           MatrixDipole( D ).max_row_sum();
+        if ( !pc.rank() )
+            cout << "single precision dipole, relative error (estimated): "
+                 << err << ", |D_single - D|_inf <= " << bound << endl;
+    }
 
-    Propagator p( D, H0, propagation.time(), laser.efield() );
+    Propagator p( *D_blocks, H0, propagation, laser.efield() );
+    p.set_field_end( laser.field_end() );
+    if ( propagation.direct ) p.use_direct_solver( D, prototype );
 
     p.register_observable( laser.get_observer() );
     p.register_observable(
         absorber.get_observer( prototype, p.get_operator_vector() ) );
-    p.register_observable( dipole.get_observer( D, prototype ) );
+    p.register_observable( dipole.get_observer( *D_blocks, prototype ) );
     p.register_observable( std::unique_ptr<Observable>(
-        new EigenstateObserver( p.H, 10, "./", 10, prototype.front() ) ) );
+        new EigenstateObserver( *D_blocks, H0, laser.efield(), 10, "./", 10,
+                                prototype.front() ) ) );
+    // every other initial state gets its own folder:
+    for ( auto k = 1u; k < propagation.initial_states.size(); ++k ) {
+        auto folder = propagation.folder + "/state_" +
+                      std::to_string( propagation.initial_states[k] );
+        if ( !pc.rank() ) mkdir( folder.c_str(), 0755 );
+        MPI_Barrier( PETSC_COMM_WORLD );
+        // the same arguments, with propagate_folder replaced:
+        auto args =
+            override_arguments( argc, argv, {"propagate_folder=" + folder} );
+        vector<const char*> state_argv;
+        for ( auto& a : args ) state_argv.push_back( a.c_str() );
+        auto state_argc = static_cast<int>( state_argv.size() );
+
+        p.register_observable(
+            make_AbsorberParameters( state_argc, state_argv.data() )
+                .get_observer( prototype, p.get_operator_vector() ),
+            k );
+        p.register_observable(
+            make_DipoleParameters( state_argc, state_argv.data() )
+                .get_observer( *D_blocks, prototype ),
+            k );
+    }
 
     cout << p.observables_names() << endl;
 
-    auto psi = p.get_operator_vector();
-    psi.set_value( 0, 1. );
-    psi.assemble();
-    p.run( psi );
+    p.run( propagation.initial_wavefunctions( p.get_operator_vector() ) );
     // H0.conjugate();
     // H0.print();
 
@@ -0,0 +1,176 @@
+#include <utilities/async_writer.hpp>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace Erwin
+{
+
+AsyncWriter& AsyncWriter::shared()
+{
+    static AsyncWriter writer;
+    return writer;
+}
+
+AsyncWriter::AsyncWriter() {}
+
+AsyncWriter::~AsyncWriter()
+{
+    if ( !worker.joinable() ) return;
+    done.store( true, std::memory_order_release );
+    worker.join();
+}
+
+size_t AsyncWriter::open( const std::string& filename,
+                          size_t bytes,
+                          const std::string& schema )
+{
+    if ( bytes == 0 || bytes > max_record )
+        throw std::invalid_argument( "AsyncWriter: records of " +
+                                     std::to_string( bytes ) +
+                                     " bytes in " + filename );
+    auto f = std::fopen( filename.c_str(), "ab" );
+    if ( !f ) throw std::runtime_error( "file didn't open: " + filename );
+    std::fseek( f, 0, SEEK_END );
+    if ( std::ftell( f ) == 0 &&
+         ( std::fprintf( f, "erwin-records 1 %lu %s\n",
+                         static_cast<unsigned long>( bytes ),
+                         schema.c_str() ) < 0 ||
+           std::fflush( f ) != 0 ) ) {
+        const std::string what = std::strerror( errno );
+        std::fclose( f );
+        throw std::runtime_error( "AsyncWriter: couldn't write the header of " +
+                                  filename + ": " + what );
+    }
+    // the first file starts the background thread:
+    if ( !worker.joinable() ) worker = std::thread( &AsyncWriter::run, this );
+    const auto file = record_bytes.size();
+    record_bytes.push_back( bytes );
+    slot s{slot::kind::open, file, {}};
+    std::memcpy( s.data.data(), &f, sizeof( f ) );
+    std::memcpy( s.data.data() + sizeof( f ), &bytes, sizeof( bytes ) );
+    put( s );
+    return file;
+}
+
+void AsyncWriter::push( size_t file, const void* record )
+{
+    check();
+    slot s{slot::kind::record, file, {}};
+    std::memcpy( s.data.data(), record, record_bytes[file] );
+    put( s );
+}
+
+void AsyncWriter::close( size_t file )
+{
+    put( {slot::kind::close, file, {}} );
+}
+
+void AsyncWriter::flush()
+{
+    if ( !worker.joinable() ) return;
+    const auto ticket =
+        flush_requested.fetch_add( 1, std::memory_order_release ) + 1;
+    while ( flushed.load( std::memory_order_acquire ) < ticket )
+        std::this_thread::yield();
+    check();
+}
+
+void AsyncWriter::check() const
+{
+    if ( failed.load( std::memory_order_acquire ) )
+        throw std::runtime_error( error );
+}
+
+void AsyncWriter::fail( const std::string& what )
+{
+    const auto message =
+        "AsyncWriter: " + what + ": " + std::strerror( errno );
+    std::cerr << message << std::endl;
+    if ( failed.load( std::memory_order_relaxed ) ) return;
+    error = message;
+    failed.store( true, std::memory_order_release );
+}
+
+// the only producer: wait for room, fill the slot, then publish it
+void AsyncWriter::put( const slot& s )
+{
+    const auto t = tail.load( std::memory_order_relaxed );
+    while ( t - head.load( std::memory_order_acquire ) >= ring_size )
+        std::this_thread::yield();
+    ring[t % ring_size] = s;
+    tail.store( t + 1, std::memory_order_release );
+}
+
+void AsyncWriter::write( output& o )
+{
+    if ( !o.f || o.buffer.empty() ) return;
+    if ( std::fwrite( o.buffer.data(), 1, o.buffer.size(), o.f ) !=
+         o.buffer.size() )
+        fail( "writing " + std::to_string( o.buffer.size() / o.bytes ) +
+              " records" );
+    o.buffer.clear();
+}
+
+void AsyncWriter::run()
+{
+    typedef std::chrono::steady_clock clock;
+    const auto flush_interval = std::chrono::seconds( 1 );
+    auto last_flush = clock::now();
+    while ( true ) {
+        auto h = head.load( std::memory_order_relaxed );
+        const auto t = tail.load( std::memory_order_acquire );
+        const bool idle = h == t;
+        for ( ; h != t; ++h ) {
+            const auto& s = ring[h % ring_size];
+            if ( s.type == slot::kind::open ) {
+                if ( files.size() <= s.file ) files.resize( s.file + 1 );
+                auto& o = files[s.file];
+                std::memcpy( &o.f, s.data.data(), sizeof( o.f ) );
+                std::memcpy( &o.bytes, s.data.data() + sizeof( o.f ),
+                             sizeof( o.bytes ) );
+                o.buffer.reserve( buffer_bytes );
+            } else if ( s.type == slot::kind::close ) {
+                auto& o = files[s.file];
+                write( o );
+                if ( std::fclose( o.f ) != 0 ) fail( "closing a file" );
+                o.f = nullptr;
+                o.buffer = std::vector<unsigned char>();
+            } else {
+                auto& o = files[s.file];
+                o.buffer.insert( o.buffer.end(), s.data.begin(),
+                                 s.data.begin() + o.bytes );
+                if ( o.buffer.size() >= buffer_bytes ) write( o );
+            }
+            head.store( h + 1, std::memory_order_release );
+        }
+
+        // a flush covers everything pushed before it was asked for, which
+        // is all in the buffers once the ring is seen empty after the ask:
+        const auto requested =
+            flush_requested.load( std::memory_order_acquire );
+        const bool stop = done.load( std::memory_order_acquire );
+        const bool empty = head.load( std::memory_order_relaxed ) ==
+                           tail.load( std::memory_order_acquire );
+        const bool due =
+            requested != flushed.load( std::memory_order_relaxed ) || stop ||
+            clock::now() - last_flush > flush_interval;
+        if ( empty && due ) {
+            for ( auto& o : files ) {
+                write( o );
+                if ( o.f && std::fflush( o.f ) != 0 )
+                    fail( "flushing a file" );
+            }
+            flushed.store( requested, std::memory_order_release );
+            last_flush = clock::now();
+        }
+        if ( stop && empty ) break;
+        if ( idle )
+            std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+    for ( auto& o : files )
+        if ( o.f && std::fclose( o.f ) != 0 ) fail( "closing a file" );
+}
+}
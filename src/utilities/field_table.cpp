@@ -0,0 +1,96 @@
+#include <utilities/field_table.hpp>
+#include <utilities/math.hpp>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace Erwin
+{
+
+FieldTable::FieldTable( double t0_, double h_, const std::vector<double>& E )
+    : t0( t0_ ), h( h_ ), size( E.size() )
+{
+    if ( size < 2 || !( h > 0 ) )
+        throw std::invalid_argument(
+            "FieldTable: needs at least two samples, h apart" );
+    const auto n = size;
+
+    // the second derivatives (zero at the ends), by the thomas algorithm on
+    // M_i-1 + 4 M_i + M_i+1 = 6 (E_i+1 - 2 E_i + E_i-1) / h^2:
+    std::vector<double> M( n, 0. ), diagonal( n, 4. ), rhs( n, 0. );
+    for ( auto i = 1u; i + 1 < n; ++i )
+        rhs[i] = 6. * ( E[i + 1] - 2. * E[i] + E[i - 1] ) / ( h * h );
+    for ( auto i = 2u; i + 1 < n; ++i ) {
+        diagonal[i] -= 1. / diagonal[i - 1];
+        rhs[i] -= rhs[i - 1] / diagonal[i - 1];
+    }
+    for ( auto i = n - 1; i-- > 1; ) M[i] = ( rhs[i] - M[i + 1] ) / diagonal[i];
+
+    field.assign( n + 1, {{0., 0., 0., 0.}} );
+    potential.assign( n + 1, {{0., 0., 0., 0., 0.}} );
+    double A = 0;
+    for ( auto i = 0u; i + 1 < n; ++i ) {
+        auto& c = field[i + 1];
+        c[0] = E[i];
+        c[1] = ( E[i + 1] - E[i] ) / h - h * ( 2. * M[i] + M[i + 1] ) / 6.;
+        c[2] = M[i] / 2.;
+        c[3] = ( M[i + 1] - M[i] ) / ( 6. * h );
+
+        auto& p = potential[i + 1];
+        p[0] = A;
+        for ( auto k = 0u; k < 4; ++k ) p[k + 1] = -c[k] / ( k + 1 );
+        A += h * ( p[1] + h * ( p[2] + h * ( p[3] + h * p[4] ) ) );
+
+        // a sign change over the piece, found by bisection on the cubic:
+        auto cubic = [&c]( double s ) {
+            return c[0] + s * ( c[1] + s * ( c[2] + s * c[3] ) );
+        };
+        if ( math::signum( E[i] ) == 0 ||
+             math::signum( E[i] ) == math::signum( E[i + 1] ) )
+            continue;
+        double a = 0, b = h;
+        for ( int k = 0; k < 60 && b - a > 0; ++k ) {
+            auto m = ( a + b ) / 2.;
+            if ( math::signum( cubic( m ) ) == math::signum( E[i] ) )
+                a = m;
+            else
+                b = m;
+        }
+        zeros.push_back( t0 + i * h + b );
+    }
+    potential[n][0] = A;
+}
+
+FieldTable FieldTable::read( const std::string& filename )
+{
+    std::ifstream in( filename );
+    if ( !in )
+        throw std::runtime_error( "FieldTable: can't read " + filename );
+    std::vector<double> t, E;
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        std::istringstream ss( line );
+        double a, b;
+        if ( line.empty() || line[0] == '#' || !( ss >> a >> b ) ) continue;
+        t.push_back( a );
+        E.push_back( b );
+    }
+    if ( t.size() < 2 )
+        throw std::invalid_argument( "FieldTable: " + filename +
+                                     " has fewer than two samples" );
+    const auto h = ( t.back() - t.front() ) / ( t.size() - 1 );
+    for ( auto i = 0u; i < t.size(); ++i )
+        if ( std::abs( t[i] - t.front() - i * h ) > 1e-6 * h )
+            throw std::invalid_argument( "FieldTable: the times in " +
+                                         filename + " aren't evenly spaced" );
+    return FieldTable( t.front(), h, E );
+}
+
+std::experimental::optional<double> FieldTable::crossing( double a,
+                                                          double b ) const
+{
+    auto z = std::upper_bound( zeros.begin(), zeros.end(), a );
+    if ( z == zeros.end() || *z > b ) return {};
+    return *z;
+}
+}
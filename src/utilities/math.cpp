@@ -1,8 +1,12 @@
 #include <utilities/math.hpp>
 #include <complex>
 #include <vector>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
 // gsl
 #include <gsl/gsl_sf_coupling.h>
+#include <gsl/gsl_sf_bessel.h>
 
 namespace Erwin
 {
@@ -62,5 +66,117 @@ namespace math
         }
         return grid;
     }
+
+    std::vector<std::complex<double>>
+    expm( const std::vector<std::complex<double>>& A, size_t n )
+    {
+        typedef std::complex<double> complex;
+        using std::vector;
+        assert( A.size() == n * n );
+
+        auto multiply = [n]( const vector<complex>& a,
+                             const vector<complex>& b ) {
+            vector<complex> c( n * n, 0. );
+            for ( size_t i = 0; i < n; ++i )
+                for ( size_t k = 0; k < n; ++k )
+                    for ( size_t j = 0; j < n; ++j )
+                        c[i * n + j] += a[i * n + k] * b[k * n + j];
+            return c;
+        };
+
+        // scale A so that |A / 2^s| < 1/2:
+        double norm = 0;
+        for ( size_t i = 0; i < n; ++i ) {
+            double row = 0;
+            for ( size_t j = 0; j < n; ++j ) row += std::abs( A[i * n + j] );
+            norm = std::max( norm, row );
+        }
+        int s = norm > .5
+                    ? static_cast<int>( std::ceil( std::log2( norm ) ) ) + 1
+                    : 0;
+        vector<complex> X( A );
+        for ( auto& x : X ) x = std::ldexp( 1., -s ) * x;
+
+        const double c[] = {1.,          1. / 2.,      5. / 44.,
+                            1. / 66.,    1. / 792.,    1. / 15840.,
+                            1. / 665280.};
+        vector<complex> N( n * n, 0. ), D( n * n, 0. ), P( n * n, 0. );
+        for ( size_t i = 0; i < n; ++i ) P[i * n + i] = 1.;
+        for ( int k = 0; k <= 6; ++k ) {
+            if ( k > 0 ) P = multiply( P, X );
+            double sign = k % 2 ? -1. : 1.;
+            for ( size_t i = 0; i < n * n; ++i ) {
+                N[i] += c[k] * P[i];
+                D[i] += sign * c[k] * P[i];
+            }
+        }
+
+        // solve D F = N:
+        auto pivots = lu_factor( D, n );
+        lu_solve( D, pivots, n, N.data(), n );
+
+        for ( int i = 0; i < s; ++i ) N = multiply( N, N );
+        return N;
+    }
+
+    std::vector<double> chebyshev_exp_coefficients( double alpha,
+                                                    double tolerance )
+    {
+        std::vector<double> J;
+        for ( int k = 0;; ++k ) {
+            J.push_back( gsl_sf_bessel_Jn( k, alpha ) );
+            if ( k > alpha && std::abs( J.back() ) < tolerance ) break;
+        }
+        return J;
+    }
+
+    std::vector<size_t> lu_factor( std::vector<std::complex<double>>& A,
+                                   size_t n )
+    {
+        assert( A.size() == n * n );
+        std::vector<size_t> pivots( n );
+        for ( size_t col = 0; col < n; ++col ) {
+            size_t pivot = col;
+            for ( size_t i = col + 1; i < n; ++i )
+                if ( std::abs( A[i * n + col] ) >
+                     std::abs( A[pivot * n + col] ) )
+                    pivot = i;
+            pivots[col] = pivot;
+            if ( pivot != col )
+                for ( size_t j = 0; j < n; ++j )
+                    std::swap( A[col * n + j], A[pivot * n + j] );
+            if ( A[col * n + col] == 0. )
+                throw std::domain_error( "lu_factor: singular matrix" );
+            for ( size_t i = col + 1; i < n; ++i ) {
+                auto f = A[i * n + col] /= A[col * n + col];
+                for ( size_t j = col + 1; j < n; ++j )
+                    A[i * n + j] -= f * A[col * n + j];
+            }
+        }
+        return pivots;
+    }
+
+    void lu_solve( const std::vector<std::complex<double>>& LU,
+                   const std::vector<size_t>& pivots,
+                   size_t n,
+                   std::complex<double>* B,
+                   size_t m )
+    {
+        for ( size_t i = 0; i < n; ++i )
+            if ( pivots[i] != i )
+                for ( size_t j = 0; j < m; ++j )
+                    std::swap( B[i * m + j], B[pivots[i] * m + j] );
+        // L is unit lower triangular:
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t k = 0; k < i; ++k )
+                for ( size_t j = 0; j < m; ++j )
+                    B[i * m + j] -= LU[i * n + k] * B[k * m + j];
+        for ( size_t i = n; i-- > 0; ) {
+            for ( size_t k = i + 1; k < n; ++k )
+                for ( size_t j = 0; j < m; ++j )
+                    B[i * m + j] -= LU[i * n + k] * B[k * m + j];
+            for ( size_t j = 0; j < m; ++j ) B[i * m + j] /= LU[i * n + i];
+        }
+    }
 }
 }